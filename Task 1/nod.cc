@@ -1,7 +1,42 @@
 ﻿#include <iostream>
-#include <map>
+#include <tuple>
+#include <string_view>
+#include <optional>
+#include <vector>
+#include <queue>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <array>
+#include <set>
 #include <unordered_map>
-#include <regex>
+#include <charconv>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <csignal>
+#include <type_traits>
+#include <limits>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <immintrin.h>
+#endif
 
 // Type aliases for easier modification and improved readability.
 namespace {
@@ -10,294 +45,4275 @@ namespace {
     // original mileage by 10.
     using Mileage = uint_fast64_t;
 
-    using LicensePlate = std::string;
-
     using RoadNumber = unsigned;
     using RoadCategory = char;
 
     using Road = std::pair<RoadNumber, RoadCategory>;
 
-    using MileageByRoadCategory = std::map<RoadCategory, Mileage>;
-
-    using CarStatistics = std::map<LicensePlate, MileageByRoadCategory>;
-    using RoadStatistics = std::map<Road, Mileage>;
-
-    using RoadEntranceData = std::tuple<LicensePlate, Road, Mileage>;
-
     using LineNumber = size_t;
     using Line = std::string;
 
-    using UnpairedEntrance = std::map<LicensePlate, std::tuple<Road, Mileage, LineNumber>>;
+    using ByteOffset = uint_fast64_t;
+
+    // Line is located in input by its (offset, length).
+    using LineLocation = std::pair<ByteOffset, size_t>;
 }
 
-// Conversions between raw and internal data representations.
+// Road categories.
 namespace {
-    // Converts internal Mileage representation to decimal mileage / 10.
-    inline std::string internalMileageToMileage(const Mileage mileage) {
-        return std::to_string(mileage / 10) + ',' + std::to_string(mileage % 10);
-    }
+    // Road categories are A and S.
+    constexpr size_t roadCategoriesCount = 2;
 
-    // Converts rawRoadNumber string to internal RoadNumber representation.
-    inline RoadNumber rawRoadNumberToInternal(const std::string &rawRoadNumber) {
-        return static_cast<RoadNumber>(stoul(rawRoadNumber));
+    // Converts road category to its index, in alphabetical order.
+    inline size_t roadCategoryToIndex(const RoadCategory roadCategory) {
+        return roadCategory == 'A' ? 0 : 1;
     }
 
-    // Converts rawRoadCategory string to internal RoadCategory representation.
-    inline RoadCategory rawRoadCategoryToInternal(const std::string &rawRoadCategory) {
-        return rawRoadCategory[0];
+    // Converts index of road category back to the category.
+    inline RoadCategory indexToRoadCategory(const size_t index) {
+        return index == 0 ? 'A' : 'S';
     }
+}
 
-    // Converts raw road data to internal Road representation.
-    inline Road rawRoadDataToInternal(const std::string &rawRoadNumber,
-                                      const std::string &rawRoadCategory) {
+// Statistics of cars.
+namespace {
+    // License plate of 3 to 11 alphanumerics, stored inline and padded with
+    // zeros. Last byte holds the length. Padding sorts before alphanumerics,
+    // so bytewise comparison gives the same order as comparison of strings.
+    class LicensePlate {
+    public:
+        static constexpr size_t maxLength = 11;
 
-        const RoadNumber roadNumber = rawRoadNumberToInternal(rawRoadNumber);
-        const RoadCategory roadCategory = rawRoadCategoryToInternal(rawRoadCategory);
+        // Empty license plate marks unused slots of LicensePlateMap.
+        LicensePlate() = default;
 
-        return {roadNumber, roadCategory};
-    }
+        explicit LicensePlate(const std::string_view licensePlate) {
+            std::memcpy(bytes.data(), licensePlate.data(), licensePlate.size());
+            bytes.back() = static_cast<char>(licensePlate.size());
+        }
+
+        [[nodiscard]] std::string_view view() const {
+            return {bytes.data(), static_cast<size_t>(bytes.back())};
+        }
+
+        [[nodiscard]] bool empty() const {
+            return bytes.back() == 0;
+        }
+
+        [[nodiscard]] uint64_t hash() const {
+            uint64_t low, high;
+            std::memcpy(&low, bytes.data(), sizeof(low));
+            std::memcpy(&high, bytes.data() + sizeof(low), sizeof(high));
+
+            uint64_t hash = (low ^ (high * 0x9E3779B97F4A7C15u)) * 0xBF58476D1CE4E5B9u;
+
+            return hash ^ (hash >> 31);
+        }
+
+        bool operator==(const LicensePlate &other) const {
+            return bytes == other.bytes;
+        }
+
+        bool operator<(const LicensePlate &other) const {
+            return std::memcmp(bytes.data(), other.bytes.data(), bytes.size()) < 0;
+        }
+
+    private:
+        alignas(uint64_t) std::array<char, 16> bytes{};
+    };
+
+    // Map licensePlate -> value using open addressing with linear probing,
+    // keeping entries inline in a single array.
+    template<typename Value>
+    class LicensePlateMap {
+    public:
+        using Entry = std::pair<LicensePlate, Value>;
+
+        LicensePlateMap() : entries(initialCapacity) {}
+
+        [[nodiscard]] size_t size() const {
+            return count;
+        }
+
+        [[nodiscard]] Value *find(const LicensePlate &licensePlate) {
+            Entry &entry = entries[slotOf(licensePlate)];
+
+            return entry.first.empty() ? nullptr : &entry.second;
+        }
+
+        [[nodiscard]] const Value *find(const LicensePlate &licensePlate) const {
+            const Entry &entry = entries[slotOf(licensePlate)];
+
+            return entry.first.empty() ? nullptr : &entry.second;
+        }
+
+        // Returns value for licensePlate, inserting default one if it is absent.
+        Value &operator[](const LicensePlate &licensePlate) {
+            size_t slot = slotOf(licensePlate);
+
+            if (entries[slot].first.empty()) {
+                // Keep load factor at most 1/2.
+                if (2 * (count + 1) > entries.size()) {
+                    grow();
+                    slot = slotOf(licensePlate);
+                }
+
+                entries[slot].first = licensePlate;
+                count++;
+            }
+
+            return entries[slot].second;
+        }
+
+        // Removes entry for licensePlate, if present, shifting back following
+        // entries of its cluster so that no tombstones are needed.
+        void erase(const LicensePlate &licensePlate) {
+            size_t slot = slotOf(licensePlate);
+
+            if (entries[slot].first.empty()) {
+                return;
+            }
+
+            const size_t mask = entries.size() - 1;
+
+            for (size_t next = (slot + 1) & mask; !entries[next].first.empty(); next = (next + 1) & mask) {
+                const size_t home = homeSlot(entries[next].first);
+
+                // Entry can be moved to slot if its home is not in (slot, next].
+                if (((next - home) & mask) >= ((next - slot) & mask)) {
+                    entries[slot] = std::move(entries[next]);
+                    slot = next;
+                }
+            }
+
+            entries[slot] = Entry();
+            count--;
+        }
+
+        // Calls function(licensePlate, value) for every entry, in no particular order.
+        template<typename Function>
+        void forEach(Function &&function) const {
+            for (const Entry &entry : entries) {
+                if (!entry.first.empty()) {
+                    function(entry.first, entry.second);
+                }
+            }
+        }
+
+        // Returns all entries sorted by license plate.
+        [[nodiscard]] std::vector<const Entry *> sortedEntries() const {
+            std::vector<const Entry *> sorted;
+            sorted.reserve(count);
+
+            for (const Entry &entry : entries) {
+                if (!entry.first.empty()) {
+                    sorted.push_back(&entry);
+                }
+            }
+
+            std::sort(sorted.begin(), sorted.end(), [](const Entry *a, const Entry *b) {
+                return a->first < b->first;
+            });
+
+            return sorted;
+        }
+
+    private:
+        static constexpr size_t initialCapacity = 16;
+
+        [[nodiscard]] size_t homeSlot(const LicensePlate &licensePlate) const {
+            return licensePlate.hash() & (entries.size() - 1);
+        }
+
+        // Returns slot holding licensePlate or empty slot where it belongs.
+        [[nodiscard]] size_t slotOf(const LicensePlate &licensePlate) const {
+            const size_t mask = entries.size() - 1;
+            size_t slot = homeSlot(licensePlate);
 
-    // Converts raw mileage data to internal Mileage representation.
-    inline Mileage rawMileageDataToInternal(const std::string &rawMileageIntegerPart,
-                                            const std::string &rawMileageDecimalPart) {
+            while (!entries[slot].first.empty() && !(entries[slot].first == licensePlate)) {
+                slot = (slot + 1) & mask;
+            }
+
+            return slot;
+        }
+
+        void grow() {
+            std::vector<Entry> oldEntries(2 * entries.size());
+            oldEntries.swap(entries);
+
+            for (Entry &entry : oldEntries) {
+                if (!entry.first.empty()) {
+                    entries[slotOf(entry.first)] = std::move(entry);
+                }
+            }
+        }
+
+        std::vector<Entry> entries;
+        size_t count = 0;
+    };
+
+    // Mileages of a car on every road category it has driven on.
+    class MileageByRoadCategory {
+    public:
+        void add(const RoadCategory roadCategory, const Mileage distance) {
+            const size_t index = roadCategoryToIndex(roadCategory);
+
+            mileages[index] += distance;
+            present[index] = true;
+        }
+
+        // Returns mileage on road category or nullptr if car has not driven on it.
+        [[nodiscard]] const Mileage *find(const RoadCategory roadCategory) const {
+            const size_t index = roadCategoryToIndex(roadCategory);
+
+            return present[index] ? &mileages[index] : nullptr;
+        }
+
+        // Checks whether car has not driven on any road category.
+        [[nodiscard]] bool empty() const {
+            return std::none_of(present.begin(), present.end(), [](const bool isPresent) { return isPresent; });
+        }
 
-        return static_cast<Mileage>(stoull(rawMileageIntegerPart) * 10
-                                    + stoull(rawMileageDecimalPart));
+        // Returns mileage on all road categories.
+        [[nodiscard]] Mileage total() const {
+            Mileage total = 0;
+
+            forEach([&total](const RoadCategory, const Mileage mileage) { total += mileage; });
+
+            return total;
+        }
+
+        // Calls function(roadCategory, mileage) for every present category, in alphabetical order.
+        template<typename Function>
+        void forEach(Function &&function) const {
+            for (size_t index = 0; index < roadCategoriesCount; index++) {
+                if (present[index]) {
+                    function(indexToRoadCategory(index), mileages[index]);
+                }
+            }
+        }
+
+    private:
+        std::array<Mileage, roadCategoriesCount> mileages{};
+        std::array<bool, roadCategoriesCount> present{};
+    };
+
+    // Map licensePlate -> (roadCategory -> mileage).
+    using CarStatistics = LicensePlateMap<MileageByRoadCategory>;
+
+    // Map licensePlate -> ((roadNumber, roadCategory), mileage, lineNumber, lineLocation).
+    using UnpairedEntrance = LicensePlateMap<std::tuple<Road, Mileage, LineNumber, LineLocation>>;
+}
+
+// Conversions between raw and internal data representations.
+namespace {
+    // Converts digit character to its numeric value.
+    inline unsigned digitToInternal(const char digit) {
+        return static_cast<unsigned>(digit - '0');
     }
 }
 
-// Parsing line events.
+// Statistics of roads.
 namespace {
-    // Parses line of the form - Car A1 13,4.
-    RoadEntranceData parseRoadEntrance(std::smatch &matches) {
-        const std::string licensePlate = matches.str(1);
+    // Map (roadNumber, roadCategory) -> mileage, stored densely in an array
+    // indexed by (roadNumber, roadCategory) in the order of std::pair, with
+    // presence of every road kept in a bitmap.
+    class RoadStatistics {
+    public:
+        class const_iterator {
+        public:
+            const_iterator(const RoadStatistics &statistics, const size_t index)
+                    : statistics(statistics), index(statistics.nextPresentIndex(index)) {}
+
+            std::pair<Road, Mileage> operator*() const {
+                return {indexToRoad(index), statistics.mileages[index]};
+            }
 
-        const std::string rawRoadCategory = matches.str(2);
-        const std::string rawRoadNumber = matches.str(3);
+            const_iterator &operator++() {
+                index = statistics.nextPresentIndex(index + 1);
 
-        const Road road = rawRoadDataToInternal(rawRoadNumber, rawRoadCategory);
+                return *this;
+            }
 
-        const std::string rawMileageIntegerPart = matches.str(4);
-        const std::string rawMileageDecimalPart = matches.str(5);
+            bool operator!=(const const_iterator &other) const {
+                return index != other.index;
+            }
 
-        const Mileage mileage = rawMileageDataToInternal(rawMileageIntegerPart,
-                                                         rawMileageDecimalPart);
+        private:
+            const RoadStatistics &statistics;
+            size_t index;
+        };
 
-        return {licensePlate, road, mileage};
-    }
+        [[nodiscard]] const_iterator begin() const {
+            return {*this, 0};
+        }
 
-    // Parses query concerning distance driven on all road categories by a given car.
-    inline LicensePlate parseCarMileageQuery(std::smatch &matches) {
-        return matches.str(1);
-    }
+        [[nodiscard]] const_iterator end() const {
+            return {*this, roadsCount};
+        }
+
+        // Adds distance to mileage of road, which becomes present.
+        void add(const Road &road, const Mileage distance) {
+            const size_t index = roadToIndex(road);
 
-    // Parses query concerning total distance driven by all cars on a given road.
-    Road parseRoadMileageQuery(std::smatch &matches) {
-        const std::string rawRoadCategory = matches.str(1);
-        const std::string rawRoadNumber = matches.str(2);
+            mileages[index] += distance;
+            presence[index / wordBits] |= presenceBit(index);
+        }
 
-        const Road road = rawRoadDataToInternal(rawRoadNumber, rawRoadCategory);
+        // Returns mileage of road or nullptr if road is not present.
+        [[nodiscard]] const Mileage *find(const Road &road) const {
+            const size_t index = roadToIndex(road);
 
-        return road;
-    }
+            return isPresent(index) ? &mileages[index] : nullptr;
+        }
+
+        // Adds mileages of all roads present in other statistics.
+        void merge(const RoadStatistics &other) {
+            for (size_t index = 0; index < roadsCount; index++) {
+                mileages[index] += other.mileages[index];
+            }
+
+            for (size_t word = 0; word < presenceWords; word++) {
+                presence[word] |= other.presence[word];
+            }
+        }
+
+    private:
+        // Road numbers are in range [1, 999].
+        static constexpr size_t roadNumbersCount = 1000;
+        static constexpr size_t roadsCount = roadNumbersCount * roadCategoriesCount;
+
+        static constexpr size_t wordBits = 64;
+        static constexpr size_t presenceWords = (roadsCount + wordBits - 1) / wordBits;
+
+        static size_t roadToIndex(const Road &road) {
+            const auto [roadNumber, roadCategory] = road;
+
+            return roadNumber * roadCategoriesCount + roadCategoryToIndex(roadCategory);
+        }
+
+        static Road indexToRoad(const size_t index) {
+            return {static_cast<RoadNumber>(index / roadCategoriesCount),
+                    indexToRoadCategory(index % roadCategoriesCount)};
+        }
+
+        static uint64_t presenceBit(const size_t index) {
+            return uint64_t(1) << (index % wordBits);
+        }
+
+        [[nodiscard]] bool isPresent(const size_t index) const {
+            return (presence[index / wordBits] & presenceBit(index)) != 0;
+        }
+
+        // Returns first present index not lower than index, or roadsCount.
+        [[nodiscard]] size_t nextPresentIndex(size_t index) const {
+            while (index < roadsCount && !isPresent(index)) {
+                // Skip whole words without present roads.
+                if (index % wordBits == 0 && presence[index / wordBits] == 0) {
+                    index += wordBits;
+                } else {
+                    index++;
+                }
+            }
+
+            return std::min(index, roadsCount);
+        }
+
+        std::array<Mileage, roadsCount> mileages{};
+        std::array<uint64_t, presenceWords> presence{};
+    };
 }
 
-// Answer output.
+// Rankings of cars and roads by mileage.
 namespace {
-    // Outputs error concerning detected erroneous line.
-    inline void outputErroneousLine(const Line &erroneousLine, const LineNumber lineNumber) {
-        std::cerr << "Error in line " << lineNumber << ": " << erroneousLine << std::endl;
-    }
+    // At most capacity keys with the highest mileages, ordered by mileage,
+    // highest first, with ties broken by key order. Mileages never decrease,
+    // so a key which is not ranked stays below the lowest ranked one until
+    // its own mileage grows.
+    template<typename Key>
+    class MileageRanking {
+    public:
+        using Entry = std::pair<Mileage, Key>;
 
-    // Outputs mileage statistics, grouped by road categories, for a car with a
-    // given licensePlate. Example: Car A 1,3 S 4,5.
-    void outputCarMileageByRoadCategories(const MileageByRoadCategory &carMileage,
-                                          const LicensePlate &licensePlate) {
+        struct HigherMileage {
+            bool operator()(const Entry &a, const Entry &b) const {
+                return a.first > b.first || (a.first == b.first && a.second < b.second);
+            }
+        };
 
-        std::cout << licensePlate;
+        using const_iterator = typename std::set<Entry, HigherMileage>::const_iterator;
 
-        for (const auto [roadCategory, mileage] : carMileage) {
-            std::cout << " " << roadCategory << " " << internalMileageToMileage(mileage);
+        [[nodiscard]] const_iterator begin() const {
+            return ranking.begin();
         }
 
-        std::cout << std::endl;
-    }
+        [[nodiscard]] const_iterator end() const {
+            return ranking.end();
+        }
+
+        [[nodiscard]] size_t getCapacity() const {
+            return capacity;
+        }
+
+        // Removes all keys and sets capacity.
+        void reset(const size_t newCapacity) {
+            ranking.clear();
+            capacity = newCapacity;
+        }
+
+        // Moves key from oldMileage (none if key had no mileage) to newMileage,
+        // which is not lower.
+        void update(const Key &key, const std::optional<Mileage> oldMileage, const Mileage newMileage) {
+            if (capacity == 0) {
+                return;
+            }
+
+            const HigherMileage higherMileage;
+            const bool isFull = ranking.size() == capacity;
+
+            if (oldMileage && (!isFull || !higherMileage(*ranking.rbegin(), {*oldMileage, key}))) {
+                ranking.erase({*oldMileage, key});
+            } else if (isFull && !higherMileage({newMileage, key}, *ranking.rbegin())) {
+                return;
+            }
+
+            ranking.emplace(newMileage, key);
+
+            if (ranking.size() > capacity) {
+                ranking.erase(std::prev(ranking.end()));
+            }
+        }
+
+    private:
+        std::set<Entry, HigherMileage> ranking;
+        size_t capacity = 0;
+    };
+
+    // Calls function(key, mileage) for at most count highest ranked keys
+    // among all rankings, which have to rank disjoint sets of keys.
+    template<typename Key, typename Function>
+    void forEachTopRanked(const std::vector<const MileageRanking<Key> *> &rankings,
+                          size_t count, Function &&function) {
+
+        using Iterator = typename MileageRanking<Key>::const_iterator;
+
+        std::vector<std::pair<Iterator, Iterator>> ranges;
+
+        for (const auto *ranking : rankings) {
+            if (ranking->begin() != ranking->end()) {
+                ranges.emplace_back(ranking->begin(), ranking->end());
+            }
+        }
+
+        const typename MileageRanking<Key>::HigherMileage higherMileage;
+
+        for (; count > 0 && !ranges.empty(); count--) {
+            auto best = ranges.begin();
+
+            for (auto range = ranges.begin(); range != ranges.end(); ++range) {
+                if (higherMileage(*range->first, *best->first)) {
+                    best = range;
+                }
+            }
+
+            function(best->first->second, best->first->first);
 
-    // Outputs mileages, grouped by road categories, for all cars.
-    void outputMileagesOfCarsByRoadCategories(const CarStatistics &mileagesOfCarsByRoadCategories) {
-        for (const auto &[licensePlate, carMileage] : mileagesOfCarsByRoadCategories) {
-            outputCarMileageByRoadCategories(carMileage, licensePlate);
+            if (++best->first == best->second) {
+                ranges.erase(best);
+            }
         }
     }
 
-    // Outputs mileage statistics, grouped by road categories, for a car
-    // with given licensePlate from statistics structure.
-    void outputCarMileageByRoadCategories(const CarStatistics &mileagesOfCarsByRoadCategories,
-                                          const LicensePlate &licensePlate) {
+    // Rankings updated every time a car drives some distance. They are built
+    // by the first top query and rebuilt by a query about more keys than they
+    // rank, so that input without top queries does not pay for them.
+    struct MileageRankings {
+        // Cars by mileage on all road categories and on every road category.
+        MileageRanking<LicensePlate> carsByTotalMileage;
+        std::array<MileageRanking<LicensePlate>, roadCategoriesCount> carsByRoadCategory;
+
+        // Roads of every road category.
+        std::array<MileageRanking<Road>, roadCategoriesCount> roadsByRoadCategory;
+
+        [[nodiscard]] size_t getCapacity() const {
+            return carsByTotalMileage.getCapacity();
+        }
+
+        // Removes all keys from rankings and sets their capacity.
+        void reset(const size_t capacity) {
+            carsByTotalMileage.reset(capacity);
+
+            for (auto &ranking : carsByRoadCategory) {
+                ranking.reset(capacity);
+            }
+
+            for (auto &ranking : roadsByRoadCategory) {
+                ranking.reset(capacity);
+            }
+        }
+
+        // Returns rankings of cars on roadCategory, or on all road categories if it is '\0'.
+        [[nodiscard]] const MileageRanking<LicensePlate> &carsRanking(const RoadCategory roadCategory) const {
+            return roadCategory == '\0' ? carsByTotalMileage
+                                        : carsByRoadCategory[roadCategoryToIndex(roadCategory)];
+        }
+
+        // Returns rankings of roads of roadCategory, or of all road categories if it is '\0'.
+        [[nodiscard]] std::vector<const MileageRanking<Road> *> roadsRankings(const RoadCategory roadCategory) const {
+            if (roadCategory != '\0') {
+                return {&roadsByRoadCategory[roadCategoryToIndex(roadCategory)]};
+            }
 
-        auto iterator = mileagesOfCarsByRoadCategories.find(licensePlate);
+            std::vector<const MileageRanking<Road> *> rankings;
 
-        if (iterator != mileagesOfCarsByRoadCategories.end()) {
-            const auto &carMileage = iterator->second;
+            for (const auto &ranking : roadsByRoadCategory) {
+                rankings.push_back(&ranking);
+            }
 
-            outputCarMileageByRoadCategories(carMileage, licensePlate);
+            return rankings;
         }
+    };
+}
+
+// Recognising characters, equivalent to character classes used by the grammar.
+namespace {
+    // Equivalent of \s - space, \t, \n, \v, \f and \r.
+    inline bool isWhitespace(const char character) {
+        return character == ' ' || (character >= '\t' && character <= '\r');
     }
 
-    // Outputs total distance driven by all cars on a given road.
-    inline void outputRoadMileage(const Road &road, Mileage mileage) {
-        const auto [roadNumber, roadCategory] = road;
+    // Equivalent of \d.
+    inline bool isDigit(const char character) {
+        return character >= '0' && character <= '9';
+    }
 
-        std::cout << roadCategory << roadNumber
-                  << " " << internalMileageToMileage(mileage) << std::endl;
+    // Equivalent of [A-Za-z0-9].
+    inline bool isAlphanumeric(const char character) {
+        return isDigit(character)
+               || (character >= 'A' && character <= 'Z')
+               || (character >= 'a' && character <= 'z');
     }
 
-    // Outputs total distance driven by all cars for every road.
-    void outputMileagesOfRoads(const RoadStatistics &mileagesOfRoads) {
-        for (const auto &[road, mileage] : mileagesOfRoads) {
-            outputRoadMileage(road, mileage);
+    // Equivalent of [AS].
+    inline bool isRoadCategory(const char character) {
+        return character == 'A' || character == 'S';
+    }
+
+    // Returns first position not before position that does not hold whitespace.
+    inline size_t skipWhitespace(const std::string_view line, size_t position) {
+        while (position < line.size() && isWhitespace(line[position])) {
+            position++;
         }
+
+        return position;
     }
 
-    // Outputs total distance driven by all cars on a given road from statistics structure.
-    void outputRoadMileage(const RoadStatistics &mileagesOfRoads, const Road &road) {
-        auto iterator = mileagesOfRoads.find(road);
+    // Returns first position not before position that does not hold a digit.
+    inline size_t skipDigits(const std::string_view line, size_t position) {
+        while (position < line.size() && isDigit(line[position])) {
+            position++;
+        }
 
-        if (iterator != mileagesOfRoads.end()) {
-            Mileage mileage = iterator->second;
+        return position;
+    }
 
-            outputRoadMileage(road, mileage);
+    // Returns first position not before position that does not hold an alphanumeric.
+    inline size_t skipAlphanumerics(const std::string_view line, size_t position) {
+        while (position < line.size() && isAlphanumeric(line[position])) {
+            position++;
         }
+
+        return position;
+    }
+
+    // Checks whether nothing but whitespace follows position.
+    inline bool isTrailingWhitespace(const std::string_view line, const size_t position) {
+        return skipWhitespace(line, position) == line.size();
     }
 }
 
-// Processing line events.
+// Scanning text for character classes many bytes at a time, with AVX2 or
+// SSE2 if the target has it and one byte at a time otherwise.
 namespace {
-    // Processes road entrance by updating information stored in statistics structures.
-    void processRoadEntrance(std::unordered_map<LineNumber, Line> &inputLineByNumber,
-                             UnpairedEntrance &unpairedCarEntrances,
-                             CarStatistics &mileagesOfCarsByRoadCategories,
-                             RoadStatistics &mileagesOfRoads,
-                             const LicensePlate &licensePlate,
-                             const Road &road,
-                             const Mileage mileage,
-                             const Line &line,
-                             const LineNumber lineNumber) {
-
-        auto iterator = unpairedCarEntrances.find(licensePlate);
-
-        if (iterator != unpairedCarEntrances.end()) {
-            const auto [previousRoad,
-            previousMileage,
-            previousLineNumber] = iterator->second;
+    // Number of bytes classified at once.
+    constexpr size_t scanBlockSize = 32;
 
-            // Pair of information found, update structures.
-            if (road == previousRoad) {
-                Mileage distance = std::max(mileage, previousMileage) -
-                                   std::min(mileage, previousMileage);
+    // Bit i of every mask tells whether byte i of a block belongs to the class.
+    struct CharacterMasks {
+        uint32_t whitespace = 0;
+        uint32_t digits = 0;
+        uint32_t alphanumerics = 0;
+    };
 
-                RoadCategory roadCategory = road.second;
+#if defined(__AVX2__)
+    // Byte mask of bytes in range [low, high].
+    inline __m256i inRange(const __m256i bytes, const char low, const char high) {
+        const __m256i shifted = _mm256_sub_epi8(bytes, _mm256_set1_epi8(low));
 
-                mileagesOfCarsByRoadCategories[licensePlate][roadCategory] += distance;
-                mileagesOfRoads[road] += distance;
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(static_cast<char>(high - low))),
+                                 shifted);
+    }
 
-                unpairedCarEntrances.erase(iterator);
-            } else {
-                // Previous information turns out to be wrong.
-                outputErroneousLine(inputLineByNumber[previousLineNumber], previousLineNumber);
-                iterator->second = {road, mileage, lineNumber};
-                inputLineByNumber[lineNumber] = line;
-            }
+    inline uint32_t newlinesOfBlock(const char *block) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
 
-            inputLineByNumber.erase(previousLineNumber);
-        } else {
-            // If there was no previous information, simply insert current one.
-            unpairedCarEntrances[licensePlate] = {road, mileage, lineNumber};
-            inputLineByNumber[lineNumber] = line;
+        return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n'))));
+    }
+
+    inline CharacterMasks classifyBlock(const char *block) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+        const __m256i whitespace = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+                                                   inRange(bytes, '\t', '\r'));
+        const __m256i digits = inRange(bytes, '0', '9');
+        const __m256i letters = inRange(_mm256_or_si256(bytes, _mm256_set1_epi8(0x20)), 'a', 'z');
+
+        return {static_cast<uint32_t>(_mm256_movemask_epi8(whitespace)),
+                static_cast<uint32_t>(_mm256_movemask_epi8(digits)),
+                static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(digits, letters)))};
+    }
+#elif defined(__SSE2__)
+    // Byte mask of bytes in range [low, high].
+    inline __m128i inRange(const __m128i bytes, const char low, const char high) {
+        const __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8(low));
+
+        return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(static_cast<char>(high - low))), shifted);
+    }
+
+    inline uint32_t newlinesOfBlock(const char *block) {
+        uint32_t newlines = 0;
+
+        for (size_t i = 0; i < scanBlockSize; i += 16) {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + i));
+
+            newlines |= static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')))) << i;
         }
+
+        return newlines;
     }
 
-    // Processes car mileage query.
-    void processCarMileageQuery(const CarStatistics &mileagesOfCarsByRoadCategories,
-                                const LicensePlate &licensePlate) {
+    inline CharacterMasks classifyBlock(const char *block) {
+        CharacterMasks masks;
+
+        for (size_t i = 0; i < scanBlockSize; i += 16) {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + i));
+            const __m128i whitespace = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+                                                    inRange(bytes, '\t', '\r'));
+            const __m128i digits = inRange(bytes, '0', '9');
+            const __m128i letters = inRange(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), 'a', 'z');
 
-        outputCarMileageByRoadCategories(mileagesOfCarsByRoadCategories, licensePlate);
+            masks.whitespace |= static_cast<uint32_t>(_mm_movemask_epi8(whitespace)) << i;
+            masks.digits |= static_cast<uint32_t>(_mm_movemask_epi8(digits)) << i;
+            masks.alphanumerics |= static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(digits, letters))) << i;
+        }
+
+        return masks;
     }
+#else
+    inline uint32_t newlinesOfBlock(const char *block) {
+        uint32_t newlines = 0;
 
-    // Processes road mileage query.
-    void processRoadMileageQuery(const RoadStatistics &mileagesOfRoads, const Road &road) {
-        outputRoadMileage(mileagesOfRoads, road);
+        for (size_t i = 0; i < scanBlockSize; i++) {
+            newlines |= static_cast<uint32_t>(block[i] == '\n') << i;
+        }
+
+        return newlines;
     }
-}
 
-int main() {
-    // Map lineNumber -> line.
-    std::unordered_map<LineNumber, Line> inputLineByNumber;
+    inline CharacterMasks classifyBlock(const char *block) {
+        CharacterMasks masks;
 
-    // Map licensePlate -> ((roadNumber, roadCategory), mileage, lineNumber).
-    UnpairedEntrance unpairedCarEntrances;
+        for (size_t i = 0; i < scanBlockSize; i++) {
+            masks.whitespace |= static_cast<uint32_t>(isWhitespace(block[i])) << i;
+            masks.digits |= static_cast<uint32_t>(isDigit(block[i])) << i;
+            masks.alphanumerics |= static_cast<uint32_t>(isAlphanumeric(block[i])) << i;
+        }
 
-    // Map licensePlate -> (roadCategory -> mileage).
-    CarStatistics mileagesOfCarsByRoadCategories;
+        return masks;
+    }
+#endif
 
-    // Map (roadNumber, roadCategory) -> mileage.
-    RoadStatistics mileagesOfRoads;
+    // Classifies at most scanBlockSize bytes of text starting at data.
+    // Masks have no bits set at and after size.
+    inline CharacterMasks classifyPrefix(const char *data, const size_t size) {
+        if (size >= scanBlockSize) {
+            return classifyBlock(data);
+        }
 
-    const std::string carRegexGroup = R"(([A-Za-z0-9]{3,11}))";
-    const std::string roadCategoriesRegexGroup = R"(([AS]))";
-    const std::string roadRegexGroup = roadCategoriesRegexGroup + R"(([1-9]\d{0,2}))";
-    const std::string mileageRegexGroup = R"((0|[1-9]\d*),(\d))";
+        // Bytes after the text must not be read, so it is copied into a block
+        // padded with zero bytes, which belong to no class.
+        std::array<char, scanBlockSize> block{};
 
-    // Regexes for checking line correctness and parsing.
-    std::regex roadEntranceRegex(R"(^\s*)" + carRegexGroup +
-                                 R"(\s+)" + roadRegexGroup +
-                                 R"(\s+)" + mileageRegexGroup + R"(\s*$)");
+        std::memcpy(block.data(), data, size);
 
-    std::regex carStatisticsQueryRegex(R"(^\s*\?\s*)" + carRegexGroup + R"(\s*$)");
-    std::regex roadStatisticsQueryRegex(R"(^\s*\?\s*)" + roadRegexGroup + R"(\s*$)");
-    std::regex allStatisticsQueryRegex(R"(^\s*\?\s*$)");
+        return classifyBlock(block.data());
+    }
 
-    LineNumber lineNumber = 0;
+    // Line with masks of character classes of its prefix, so that runs of
+    // characters of a class are skipped without looking at them one by one.
+    class ScannedLine {
+    public:
+        explicit ScannedLine(const std::string_view text)
+                : text(text), masks(classifyPrefix(text.data(), text.size())) {}
 
-    Line line;
-    while (getline(std::cin, line)) {
-        lineNumber++;
+        [[nodiscard]] size_t size() const {
+            return text.size();
+        }
 
-        // Ignore empty lines.
-        if (line.empty()) {
-            continue;
+        char operator[](const size_t position) const {
+            return text[position];
         }
 
-        // Match line against regexes and perform requested operations.
-        if (std::smatch matches; regex_match(line, matches, roadEntranceRegex)) {
-            const auto [licensePlate, road, mileage] = parseRoadEntrance(matches);
+        [[nodiscard]] std::string_view substr(const size_t position,
+                                              const size_t length = std::string_view::npos) const {
+            return text.substr(position, length);
+        }
 
-            processRoadEntrance(inputLineByNumber, unpairedCarEntrances,
-                                mileagesOfCarsByRoadCategories, mileagesOfRoads,
-                                licensePlate, road, mileage, line, lineNumber);
+        [[nodiscard]] size_t skipWhitespace(const size_t position) const {
+            return skip(masks.whitespace, position, ::skipWhitespace);
+        }
 
-        } else if (regex_match(line, allStatisticsQueryRegex)) {
-            outputMileagesOfCarsByRoadCategories(mileagesOfCarsByRoadCategories);
-            outputMileagesOfRoads(mileagesOfRoads);
-        } else {
-            std::smatch matchesOfCarQuery;
-            std::smatch matchesOfRoadQuery;
+        [[nodiscard]] size_t skipDigits(const size_t position) const {
+            return skip(masks.digits, position, ::skipDigits);
+        }
 
-            if (regex_match(line, matchesOfCarQuery, carStatisticsQueryRegex)) {
-                const LicensePlate licensePlate = parseCarMileageQuery(matchesOfCarQuery);
+        [[nodiscard]] size_t skipAlphanumerics(const size_t position) const {
+            return skip(masks.alphanumerics, position, ::skipAlphanumerics);
+        }
 
-                processCarMileageQuery(mileagesOfCarsByRoadCategories, licensePlate);
-            }
+    private:
+        // Skips characters of a class given by mask, beyond the prefix using skipCharacters.
+        template<typename SkipCharacters>
+        size_t skip(const uint32_t mask, size_t position, SkipCharacters &&skipCharacters) const {
+            if (position < scanBlockSize) {
+                const uint32_t others = ~mask >> position;
 
-            if (regex_match(line, matchesOfRoadQuery, roadStatisticsQueryRegex)) {
-                const Road road = parseRoadMileageQuery(matchesOfRoadQuery);
+                if (others != 0) {
+                    return std::min(text.size(), position + __builtin_ctz(others));
+                }
 
-                processRoadMileageQuery(mileagesOfRoads, road);
+                position = scanBlockSize;
             }
 
-            if (matchesOfCarQuery.empty() && matchesOfRoadQuery.empty()) {
-                outputErroneousLine(line, lineNumber);
-            }
+            return skipCharacters(text, position);
         }
+
+        const std::string_view text;
+        const CharacterMasks masks;
+    };
+
+    inline size_t skipWhitespace(const ScannedLine &line, const size_t position) {
+        return line.skipWhitespace(position);
+    }
+
+    inline size_t skipDigits(const ScannedLine &line, const size_t position) {
+        return line.skipDigits(position);
+    }
+
+    inline size_t skipAlphanumerics(const ScannedLine &line, const size_t position) {
+        return line.skipAlphanumerics(position);
+    }
+
+    inline bool isTrailingWhitespace(const ScannedLine &line, const size_t position) {
+        return line.skipWhitespace(position) == line.size();
+    }
+
+    // Finds newlines in a text, which does not change until reset, a block
+    // at a time, remembering newlines of the last block, so that consecutive
+    // short lines are split without scanning them again.
+    class NewlineScanner {
+    public:
+        // Returns position of the first newline in data[position, size), or size if there is none.
+        size_t find(const char *data, size_t position, const size_t size) {
+            while (true) {
+                if (position - blockBegin < scanBlockSize) {
+                    const uint32_t newlines = blockNewlines >> (position - blockBegin);
+
+                    if (newlines != 0) {
+                        return position + __builtin_ctz(newlines);
+                    }
+
+                    position = blockBegin + scanBlockSize;
+                }
+
+                if (position + scanBlockSize > size) {
+                    const auto *newline = static_cast<const char *>(std::memchr(data + position, '\n',
+                                                                                size - position));
+
+                    return newline == nullptr ? size : static_cast<size_t>(newline - data);
+                }
+
+                blockBegin = position;
+                blockNewlines = newlinesOfBlock(data + position);
+            }
+        }
+
+        // Forgets the last block, e.g. after the text has moved.
+        void reset() {
+            blockBegin = noBlock;
+        }
+
+    private:
+        // Block beginning far enough for position - blockBegin to wrap around.
+        static constexpr size_t noBlock = std::numeric_limits<size_t>::max() / 2;
+
+        size_t blockBegin = noBlock;
+        uint32_t blockNewlines = 0;
+    };
+}
+
+// Parsing line events.
+namespace {
+    enum class LineEventType {
+        // Line is empty and should be ignored.
+        Empty,
+        // Line of the form - Car A1 13,4.
+        RoadEntrance,
+        // Line of the form - ?.
+        AllStatisticsQuery,
+        // Line of the form - ? Car, ? A1 or both at once (e.g. ? A12).
+        StatisticsQuery,
+        // Line of the form - ? TOP 20 or ? TOP 20 A.
+        TopQuery,
+        // Line matching none of the above.
+        Erroneous
+    };
+
+    // Data recognised in a single line.
+    struct LineEvent {
+        LineEventType type = LineEventType::Erroneous;
+
+        LicensePlate licensePlate;
+        Road road;
+        Mileage mileage = 0;
+
+        bool isCarQuery = false;
+        bool isRoadQuery = false;
+
+        // Number of cars and roads asked for by top query, and their road
+        // category, '\0' meaning all categories.
+        size_t topCount = 0;
+        RoadCategory topRoadCategory = '\0';
+    };
+
+    // Parses license plate ([A-Za-z0-9]{3,11}) starting at position, followed
+    // by whitespace or end of line. Returns position after the plate or npos.
+    size_t parseLicensePlate(const ScannedLine &line, const size_t position,
+                             LicensePlate &licensePlate) {
+
+        const size_t end = skipAlphanumerics(line, position);
+        const size_t length = end - position;
+
+        if (length < 3 || length > LicensePlate::maxLength
+            || (end < line.size() && !isWhitespace(line[end]))) {
+
+            return std::string_view::npos;
+        }
+
+        licensePlate = LicensePlate(line.substr(position, length));
+
+        return end;
+    }
+
+    // Parses road ([AS][1-9]\d{0,2}) starting at position, followed by whitespace
+    // or end of line. Returns position after the road or npos.
+    size_t parseRoad(const ScannedLine &line, const size_t position, Road &road) {
+        if (position >= line.size() || !isRoadCategory(line[position])) {
+            return std::string_view::npos;
+        }
+
+        const size_t numberBegin = position + 1;
+        const size_t numberEnd = skipDigits(line, numberBegin);
+        const size_t numberLength = numberEnd - numberBegin;
+
+        if (numberLength < 1 || numberLength > 3 || line[numberBegin] == '0'
+            || (numberEnd < line.size() && !isWhitespace(line[numberEnd]))) {
+
+            return std::string_view::npos;
+        }
+
+        RoadNumber roadNumber = 0;
+
+        for (size_t i = numberBegin; i < numberEnd; i++) {
+            roadNumber = roadNumber * 10 + digitToInternal(line[i]);
+        }
+
+        road = {roadNumber, line[position]};
+
+        return numberEnd;
+    }
+
+    // Parses mileage ((0|[1-9]\d*),(\d)) starting at position.
+    // Returns position after the mileage or npos.
+    size_t parseMileage(const ScannedLine &line, const size_t position, Mileage &mileage) {
+        const size_t integerEnd = skipDigits(line, position);
+        const size_t integerLength = integerEnd - position;
+
+        if (integerLength < 1 || (integerLength > 1 && line[position] == '0')
+            || integerEnd + 2 > line.size()
+            || line[integerEnd] != ',' || !isDigit(line[integerEnd + 1])) {
+
+            return std::string_view::npos;
+        }
+
+        Mileage integerPart = 0;
+
+        for (size_t i = position; i < integerEnd; i++) {
+            integerPart = integerPart * 10 + digitToInternal(line[i]);
+        }
+
+        mileage = integerPart * 10 + digitToInternal(line[integerEnd + 1]);
+
+        return integerEnd + 2;
+    }
+
+    // Parses line of the form - Car A1 13,4 - into event.
+    bool parseRoadEntrance(const ScannedLine &line, LineEvent &event) {
+        size_t position = parseLicensePlate(line, skipWhitespace(line, 0), event.licensePlate);
+
+        if (position == std::string_view::npos || position == line.size()) {
+            return false;
+        }
+
+        position = parseRoad(line, skipWhitespace(line, position), event.road);
+
+        if (position == std::string_view::npos || position == line.size()) {
+            return false;
+        }
+
+        position = parseMileage(line, skipWhitespace(line, position), event.mileage);
+
+        return position != std::string_view::npos && isTrailingWhitespace(line, position);
+    }
+
+    // Parses top query arguments (TOP\s+[1-9]\d{0,8}(\s+[AS])?) starting at position,
+    // followed by whitespace until end of line.
+    bool parseTopQuery(const ScannedLine &line, size_t position, LineEvent &event) {
+        constexpr std::string_view keyword = "TOP";
+        constexpr size_t maxCountLength = 9;
+
+        if (line.substr(position, keyword.size()) != keyword) {
+            return false;
+        }
+
+        position += keyword.size();
+
+        const size_t countBegin = skipWhitespace(line, position);
+        const size_t countEnd = skipDigits(line, countBegin);
+        const size_t countLength = countEnd - countBegin;
+
+        if (countBegin == position || countLength < 1 || countLength > maxCountLength || line[countBegin] == '0') {
+            return false;
+        }
+
+        event.topCount = 0;
+
+        for (size_t i = countBegin; i < countEnd; i++) {
+            event.topCount = event.topCount * 10 + digitToInternal(line[i]);
+        }
+
+        position = skipWhitespace(line, countEnd);
+        event.topRoadCategory = '\0';
+
+        if (position > countEnd && position < line.size() && isRoadCategory(line[position])) {
+            event.topRoadCategory = line[position];
+            position++;
+        } else if (position == countEnd && position < line.size()) {
+            return false;
+        }
+
+        return isTrailingWhitespace(line, position);
+    }
+
+    // Parses queries - all statistics, car mileage, road mileage and top - into event.
+    bool parseQuery(const ScannedLine &line, LineEvent &event) {
+        size_t position = skipWhitespace(line, 0);
+
+        if (position == line.size() || line[position] != '?') {
+            return false;
+        }
+
+        position = skipWhitespace(line, position + 1);
+
+        if (position == line.size()) {
+            event.type = LineEventType::AllStatisticsQuery;
+
+            return true;
+        }
+
+        if (parseTopQuery(line, position, event)) {
+            event.type = LineEventType::TopQuery;
+
+            return true;
+        }
+
+        const size_t carEnd = parseLicensePlate(line, position, event.licensePlate);
+        event.isCarQuery = carEnd != std::string_view::npos && isTrailingWhitespace(line, carEnd);
+
+        const size_t roadEnd = parseRoad(line, position, event.road);
+        event.isRoadQuery = roadEnd != std::string_view::npos && isTrailingWhitespace(line, roadEnd);
+
+        event.type = LineEventType::StatisticsQuery;
+
+        return event.isCarQuery || event.isRoadQuery;
+    }
+
+    // Recognises line in a single pass without allocating memory.
+    LineEvent parseLine(const std::string_view text) {
+        const ScannedLine line(text);
+        LineEvent event;
+
+        if (text.empty()) {
+            event.type = LineEventType::Empty;
+        } else if (parseRoadEntrance(line, event)) {
+            event.type = LineEventType::RoadEntrance;
+        } else if (!parseQuery(line, event)) {
+            event.type = LineEventType::Erroneous;
+        }
+
+        return event;
+    }
+}
+
+// Buffered output.
+namespace {
+    // Writes whole data to descriptor. Returns false on failure.
+    bool writeAll(const int descriptor, const char *data, size_t size) {
+        while (size > 0) {
+            const ssize_t written = write(descriptor, data, size);
+
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return false;
+            }
+
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+
+        return true;
+    }
+
+    // Writer of text to a descriptor or a string, buffering it until the buffer
+    // fills up or flush is requested. Writers sharing a destination keep the
+    // order of text written through them by flushing each other before writing.
+    class OutputWriter {
+    public:
+        explicit OutputWriter(const int descriptor) : descriptor(descriptor) {}
+
+        // Writer appending text to destination, which has to outlive it.
+        explicit OutputWriter(std::string &destination) : descriptor(-1), destinationText(&destination) {}
+
+        OutputWriter(const OutputWriter &) = delete;
+        OutputWriter &operator=(const OutputWriter &) = delete;
+
+        ~OutputWriter() {
+            flush();
+        }
+
+        // Makes writer flush other writer before writing, as they share destination.
+        void shareDestinationWith(OutputWriter &other) {
+            sharingWriter = &other;
+            other.sharingWriter = this;
+        }
+
+        // Makes writer flush after every line, e.g. when input is interactive.
+        void setLineBuffered(const bool isLineBuffered) {
+            lineBuffered = isLineBuffered;
+        }
+
+        OutputWriter &operator<<(const std::string_view text) {
+            if (text.size() > buffer.size()) {
+                prepare(buffer.size());
+                flush();
+                writeOut(text.data(), text.size());
+            } else {
+                prepare(text.size());
+                std::memcpy(buffer.data() + used, text.data(), text.size());
+                used += text.size();
+            }
+
+            return *this;
+        }
+
+        OutputWriter &operator<<(const char character) {
+            prepare(1);
+            buffer[used++] = character;
+
+            return *this;
+        }
+
+        OutputWriter &operator<<(const uint_fast64_t number) {
+            prepare(maxNumberLength);
+            used = std::to_chars(buffer.data() + used, buffer.data() + buffer.size(), number).ptr - buffer.data();
+
+            return *this;
+        }
+
+        // Ends line, flushing it if writer is line buffered.
+        void endLine() {
+            *this << '\n';
+
+            if (lineBuffered) {
+                flush();
+            }
+        }
+
+        void flush() {
+            if (used > 0) {
+                writeOut(buffer.data(), used);
+                used = 0;
+            }
+        }
+
+        // Checks whether any write to the descriptor failed.
+        [[nodiscard]] bool hasFailed() const {
+            return failed;
+        }
+
+    private:
+        static constexpr size_t bufferSize = 1 << 16;
+        static constexpr size_t maxNumberLength = 20;
+
+        // Makes room for size bytes, flushing writer sharing destination first.
+        void prepare(const size_t size) {
+            if (sharingWriter != nullptr) {
+                sharingWriter->flush();
+            }
+
+            if (used + size > buffer.size()) {
+                flush();
+            }
+        }
+
+        // Writes data directly to the destination.
+        void writeOut(const char *data, const size_t size) {
+            if (destinationText != nullptr) {
+                destinationText->append(data, size);
+            } else {
+                failed |= !writeAll(descriptor, data, size);
+            }
+        }
+
+        const int descriptor;
+        std::string *const destinationText = nullptr;
+        std::array<char, bufferSize> buffer;
+        size_t used = 0;
+
+        OutputWriter *sharingWriter = nullptr;
+        bool lineBuffered = false;
+        bool failed = false;
+    };
+
+    // Checks whether descriptors refer to the same file, pipe or terminal.
+    bool isSameDestination(const int descriptor, const int otherDescriptor) {
+        struct stat status{}, otherStatus{};
+
+        return fstat(descriptor, &status) == 0 && fstat(otherDescriptor, &otherStatus) == 0
+               && status.st_dev == otherStatus.st_dev && status.st_ino == otherStatus.st_ino;
+    }
+
+    // Getter for writer of answers to avoid static initialization fiasco.
+    OutputWriter &answerOutput() {
+        static OutputWriter output(STDOUT_FILENO);
+
+        return output;
+    }
+
+    // Getter for writer of errors to avoid static initialization fiasco.
+    OutputWriter &errorOutput() {
+        static OutputWriter output(STDERR_FILENO);
+
+        return output;
+    }
+
+    // Sets up standard writers, which are line buffered for interactive input
+    // and for input which never ends.
+    void setUpOutput(const bool isEndless) {
+        if (isSameDestination(STDOUT_FILENO, STDERR_FILENO)) {
+            answerOutput().shareDestinationWith(errorOutput());
+        }
+
+        const bool isLineBuffered = isEndless || isatty(STDIN_FILENO);
+
+        answerOutput().setLineBuffered(isLineBuffered);
+        errorOutput().setLineBuffered(isLineBuffered);
+    }
+
+    // Flushes standard writers.
+    void flushOutput() {
+        answerOutput().flush();
+        errorOutput().flush();
+    }
+}
+
+// Answer output.
+namespace {
+    // Outputs mileage in decimal form with one digit after comma. Example: 13,4.
+    inline void outputMileage(OutputWriter &output, const Mileage mileage) {
+        output << mileage / 10 << ',' << static_cast<char>('0' + mileage % 10);
+    }
+
+    // Outputs error concerning detected erroneous line.
+    inline void outputErroneousLine(const std::string_view erroneousLine, const LineNumber lineNumber) {
+        OutputWriter &output = errorOutput();
+
+        output << "Error in line " << lineNumber << ": " << erroneousLine;
+        output.endLine();
+    }
+
+    // Outputs mileage statistics, grouped by road categories, for a car with a
+    // given licensePlate. Example: Car A 1,3 S 4,5.
+    void outputCarMileageByRoadCategories(OutputWriter &output,
+                                          const MileageByRoadCategory &carMileage,
+                                          const LicensePlate &licensePlate) {
+
+        output << licensePlate.view();
+
+        carMileage.forEach([&output](const RoadCategory roadCategory, const Mileage mileage) {
+            output << ' ' << roadCategory << ' ';
+            outputMileage(output, mileage);
+        });
+
+        output.endLine();
+    }
+
+    // Outputs mileages, grouped by road categories, for all cars in order of license plates.
+    void outputMileagesOfCarsByRoadCategories(OutputWriter &output,
+                                              const CarStatistics &mileagesOfCarsByRoadCategories) {
+
+        for (const auto *entry : mileagesOfCarsByRoadCategories.sortedEntries()) {
+            outputCarMileageByRoadCategories(output, entry->second, entry->first);
+        }
+    }
+
+    // Outputs mileage statistics, grouped by road categories, for a car
+    // with given licensePlate from statistics structure.
+    void outputCarMileageByRoadCategories(OutputWriter &output,
+                                          const CarStatistics &mileagesOfCarsByRoadCategories,
+                                          const LicensePlate &licensePlate) {
+
+        const MileageByRoadCategory *carMileage = mileagesOfCarsByRoadCategories.find(licensePlate);
+
+        if (carMileage != nullptr) {
+            outputCarMileageByRoadCategories(output, *carMileage, licensePlate);
+        }
+    }
+
+    // Outputs total distance driven by all cars on a given road.
+    inline void outputRoadMileage(OutputWriter &output, const Road &road, Mileage mileage) {
+        const auto [roadNumber, roadCategory] = road;
+
+        output << roadCategory << static_cast<uint_fast64_t>(roadNumber) << ' ';
+        outputMileage(output, mileage);
+        output.endLine();
+    }
+
+    // Outputs at most count cars with the highest mileage among carsRankings,
+    // each as by car mileage query, followed by at most count roads with the
+    // highest mileage among roadsRankings. carMileageOf(licensePlate) returns
+    // statistics of a ranked car.
+    template<typename CarMileageOf>
+    void outputTopMileages(OutputWriter &output,
+                           const std::vector<const MileageRanking<LicensePlate> *> &carsRankings,
+                           CarMileageOf &&carMileageOf,
+                           const std::vector<const MileageRanking<Road> *> &roadsRankings,
+                           const size_t count) {
+
+        forEachTopRanked(carsRankings, count, [&](const LicensePlate &licensePlate, Mileage) {
+            outputCarMileageByRoadCategories(output, carMileageOf(licensePlate), licensePlate);
+        });
+
+        forEachTopRanked(roadsRankings, count, [&output](const Road &road, const Mileage mileage) {
+            outputRoadMileage(output, road, mileage);
+        });
+    }
+
+    // Outputs total distance driven by all cars for every road.
+    void outputMileagesOfRoads(OutputWriter &output, const RoadStatistics &mileagesOfRoads) {
+        for (const auto &[road, mileage] : mileagesOfRoads) {
+            outputRoadMileage(output, road, mileage);
+        }
+    }
+
+    // Outputs total distance driven by all cars on a given road from statistics structure.
+    void outputRoadMileage(OutputWriter &output, const RoadStatistics &mileagesOfRoads, const Road &road) {
+        const Mileage *mileage = mileagesOfRoads.find(road);
+
+        if (mileage != nullptr) {
+            outputRoadMileage(output, road, *mileage);
+        }
+    }
+}
+
+// Instrumentation, compiled in only with NOD_INSTRUMENTATION defined.
+namespace {
+#ifdef NOD_INSTRUMENTATION
+    constexpr bool instrumented = true;
+#else
+    constexpr bool instrumented = false;
+#endif
+
+    // Set by signal handler when a dump of instrumentation is requested.
+    volatile std::sig_atomic_t instrumentationDumpRequested = 0;
+
+    // Signal handler requesting a dump of instrumentation.
+    extern "C" void requestInstrumentationDump(int) {
+        instrumentationDumpRequested = 1;
+    }
+
+    // Time stamp counter cycles, or nanoseconds where there is no such counter.
+    using Ticks = uint_fast64_t;
+
+    inline Ticks readTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // Stages of processing lines, timed separately.
+    enum class Stage : size_t {
+        Reading,
+        Parsing,
+        Updating,
+        Output,
+    };
+
+    constexpr size_t stagesCount = 4;
+    constexpr std::array<std::string_view, stagesCount> stageNames = {"reading", "parsing", "updating", "output"};
+
+    // Counters gathered by a single thread, added to totals from time to time.
+    struct StageCounters {
+        std::array<Ticks, stagesCount> ticks{};
+
+        uint_fast64_t lines = 0;
+        uint_fast64_t entrances = 0;
+        uint_fast64_t queries = 0;
+        uint_fast64_t erroneousLines = 0;
+        uint_fast64_t revealedErrors = 0;
+        uint_fast64_t pairedEntrances = 0;
+        uint_fast64_t peakUnpairedEntrances = 0;
+
+        void add(const StageCounters &other) {
+            for (size_t stage = 0; stage < stagesCount; stage++) {
+                ticks[stage] += other.ticks[stage];
+            }
+
+            lines += other.lines;
+            entrances += other.entrances;
+            queries += other.queries;
+            erroneousLines += other.erroneousLines;
+            revealedErrors += other.revealedErrors;
+            pairedEntrances += other.pairedEntrances;
+            peakUnpairedEntrances = std::max(peakUnpairedEntrances, other.peakUnpairedEntrances);
+        }
+
+        // Notes current number of unpaired entrances.
+        void noteUnpairedEntrances(const size_t unpairedEntrances) {
+            if (instrumented) {
+                peakUnpairedEntrances = std::max<uint_fast64_t>(peakUnpairedEntrances, unpairedEntrances);
+            }
+        }
+    };
+
+    // Adds ticks elapsed from construction to destruction to a stage.
+    class StageTimer {
+    public:
+        StageTimer(StageCounters &counters, const Stage stage)
+                : counters(counters), stage(static_cast<size_t>(stage)), start(instrumented ? readTicks() : 0) {}
+
+        StageTimer(const StageTimer &) = delete;
+        StageTimer &operator=(const StageTimer &) = delete;
+
+        ~StageTimer() {
+            if (instrumented) {
+                counters.ticks[stage] += readTicks() - start;
+            }
+        }
+
+        // Returns ticks elapsed from construction.
+        [[nodiscard]] Ticks elapsed() const {
+            return instrumented ? readTicks() - start : 0;
+        }
+
+    private:
+        StageCounters &counters;
+        const size_t stage;
+        const Ticks start;
+    };
+
+    // Histogram of latencies, bucket k counts latencies in [2^k, 2^(k+1)) ticks.
+    class LatencyHistogram {
+    public:
+        void add(const Ticks latency) {
+            buckets[latency == 0 ? 0 : std::numeric_limits<Ticks>::digits - 1 - __builtin_clzll(latency)]++;
+        }
+
+        // Outputs non-empty buckets, one per line.
+        void output(OutputWriter &output) const {
+            for (size_t bucket = 0; bucket < buckets.size(); bucket++) {
+                if (buckets[bucket] > 0) {
+                    output << "  [" << (Ticks(1) << bucket) << ", " << (Ticks(2) << bucket) << ") "
+                           << buckets[bucket];
+                    output.endLine();
+                }
+            }
+        }
+
+    private:
+        std::array<uint_fast64_t, std::numeric_limits<Ticks>::digits> buckets{};
+    };
+
+    // Totals of counters of all threads and latencies of queries, dumped to a
+    // file at the end and on SIGUSR2.
+    class Instrumentation {
+    public:
+        // Makes dumps append to file with a given path. Returns false on failure.
+        bool setDumpPath(const char *path) {
+            descriptor = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+            return descriptor >= 0;
+        }
+
+        void add(const StageCounters &counters) {
+            if (!instrumented) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            totals.add(counters);
+        }
+
+        // Adds latency of answering query of a given type.
+        void addQueryLatency(const LineEventType type, const Ticks latency) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            queryLatencies[queryIndex(type)].add(latency);
+        }
+
+        // Adds counters and dumps totals if it was requested by a signal.
+        void dumpIfRequested(StageCounters &counters) {
+            if (instrumented && instrumentationDumpRequested) {
+                instrumentationDumpRequested = 0;
+                add(counters);
+                counters = {};
+                dump();
+            }
+        }
+
+        void dump() {
+            if (descriptor < 0) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            OutputWriter output(descriptor);
+
+            const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            const auto linesPerSecond = static_cast<uint_fast64_t>(elapsed > 0 ? totals.lines / elapsed : 0);
+
+            output << "lines " << totals.lines << ", " << linesPerSecond << " per second";
+            output.endLine();
+            output << "entrances " << totals.entrances << ", paired " << totals.pairedEntrances
+                   << ", peak unpaired " << totals.peakUnpairedEntrances;
+            output.endLine();
+            output << "queries " << totals.queries;
+            output.endLine();
+            output << "erroneous lines " << totals.erroneousLines
+                   << ", erroneous entrances revealed later " << totals.revealedErrors;
+            output.endLine();
+
+            for (size_t stage = 0; stage < stagesCount; stage++) {
+                output << stageNames[stage] << ' ' << totals.ticks[stage] << ' ' << ticksUnit;
+                output.endLine();
+            }
+
+            for (size_t query = 0; query < queryNames.size(); query++) {
+                output << queryNames[query] << " query latency in " << ticksUnit;
+                output.endLine();
+                queryLatencies[query].output(output);
+            }
+
+            output.endLine();
+        }
+
+    private:
+#if defined(__x86_64__) || defined(__i386__)
+        static constexpr std::string_view ticksUnit = "cycles";
+#else
+        static constexpr std::string_view ticksUnit = "ns";
+#endif
+
+        static constexpr std::array<std::string_view, 3> queryNames = {"all statistics", "statistics", "top"};
+
+        static size_t queryIndex(const LineEventType type) {
+            switch (type) {
+                case LineEventType::AllStatisticsQuery:
+                    return 0;
+                case LineEventType::StatisticsQuery:
+                    return 1;
+                default:
+                    return 2;
+            }
+        }
+
+        std::mutex mutex;
+        int descriptor = -1;
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        StageCounters totals;
+        std::array<LatencyHistogram, queryNames.size()> queryLatencies;
+    };
+
+    // Getter for instrumentation to avoid static initialization fiasco.
+    Instrumentation &instrumentation() {
+        static Instrumentation totals;
+
+        return totals;
+    }
+}
+
+// Reading input.
+namespace {
+    // Reads whole data from descriptor at offset. Returns false on failure.
+    bool readAllAt(const int descriptor, char *data, size_t size, ByteOffset offset) {
+        while (size > 0) {
+            const ssize_t bytesRead = pread(descriptor, data, size, static_cast<off_t>(offset));
+
+            if (bytesRead <= 0) {
+                if (bytesRead < 0 && errno == EINTR) {
+                    continue;
+                }
+
+                return false;
+            }
+
+            data += bytesRead;
+            size -= static_cast<size_t>(bytesRead);
+            offset += static_cast<ByteOffset>(bytesRead);
+        }
+
+        return true;
+    }
+
+    // Writes whole data to descriptor at offset. Returns false on failure.
+    bool writeAllAt(const int descriptor, const char *data, size_t size, ByteOffset offset) {
+        while (size > 0) {
+            const ssize_t written = pwrite(descriptor, data, size, static_cast<off_t>(offset));
+
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return false;
+            }
+
+            data += written;
+            size -= static_cast<size_t>(written);
+            offset += static_cast<ByteOffset>(written);
+        }
+
+        return true;
+    }
+
+    // Texts of lines of pending entrances, kept for input which cannot be read
+    // again. Texts are appended to a log, which is compacted once texts of
+    // released lines make up most of it, so it stays within twice the size of
+    // kept texts. The log is held in memory up to memoryLimit and then moved
+    // to a temporary file, except for its tail, which is written in blocks.
+    // If no temporary file can be created, the log stays in memory.
+    class PendingLineStore {
+    public:
+        // Keeps text of line at location.
+        void keep(const LineLocation &location, const std::string_view line) {
+            positions[location.first] = {fileSize + tail.size(), line.size()};
+            tail += line;
+            keptSize += line.size();
+
+            if (tail.size() > (file == nullptr ? memoryLimit : blockSize)) {
+                flushTail();
+            }
+        }
+
+        // Releases text of line at location, if it is kept.
+        void release(const LineLocation &location) {
+            if (positions.erase(location.first) == 0) {
+                return;
+            }
+
+            keptSize -= location.second;
+
+            if (fileSize + tail.size() > std::max(minCompactedSize, 2 * keptSize)) {
+                compact();
+            }
+        }
+
+        // Returns kept text of line at location, or an empty line if it is not kept.
+        [[nodiscard]] Line lineAt(const LineLocation &location) const {
+            const auto found = positions.find(location.first);
+
+            if (found == positions.end()) {
+                return Line();
+            }
+
+            const auto [position, length] = found->second;
+
+            if (position >= fileSize) {
+                return tail.substr(position - fileSize, length);
+            }
+
+            Line line(length, '\0');
+
+            if (!readAllAt(fileno(file.get()), line.data(), length, position)) {
+                line.clear();
+            }
+
+            return line;
+        }
+
+    private:
+        static constexpr ByteOffset memoryLimit = 64 << 20;
+        static constexpr ByteOffset blockSize = 1 << 20;
+        static constexpr ByteOffset minCompactedSize = 1 << 20;
+
+        // Moves the tail of the log to the temporary file, creating it if needed.
+        void flushTail() {
+            if (file == nullptr) {
+                file.reset(std::tmpfile());
+            }
+
+            if (file != nullptr && writeAllAt(fileno(file.get()), tail.data(), tail.size(), fileSize)) {
+                fileSize += tail.size();
+                tail.clear();
+            }
+        }
+
+        // Rewrites kept texts into a new log.
+        void compact() {
+            PendingLineStore compacted;
+
+            compacted.positions.reserve(positions.size());
+
+            for (const auto &[offset, position] : positions) {
+                compacted.keep({offset, position.second}, lineAt({offset, position.second}));
+            }
+
+            *this = std::move(compacted);
+        }
+
+        // Map offset in input -> (position in log, length).
+        std::unordered_map<ByteOffset, LineLocation> positions;
+
+        // Log is [0, fileSize) of file followed by tail.
+        std::unique_ptr<FILE, decltype(&fclose)> file{nullptr, fclose};
+        ByteOffset fileSize = 0;
+        std::string tail;
+
+        ByteOffset keptSize = 0;
+    };
+
+    // Source of consecutive input lines.
+    class InputSource {
+    public:
+        // Offsets of lines restored from a checkpoint are marked by the highest bit.
+        static constexpr ByteOffset restoredLineFlag = ByteOffset(1) << 63;
+
+        virtual ~InputSource() = default;
+
+        // Reads next line without the trailing newline, together with its offset
+        // in input. Returns false at the end of input.
+        virtual bool readLine(std::string_view &line, ByteOffset &offset) = 0;
+
+        // Checks whether read lines stay valid as long as the source exists,
+        // and not only until the next read.
+        [[nodiscard]] virtual bool isPersistent() const = 0;
+
+        // Checks whether input ended because it could not be read further.
+        [[nodiscard]] virtual bool hasFailed() const {
+            return false;
+        }
+
+        // Continues reading from offset of an input read before, if the source
+        // can be read again from its beginning. Streams are taken to be
+        // continuations of the input read before and ignore it.
+        virtual void resumeAt([[maybe_unused]] const ByteOffset offset) {}
+
+        // Makes lines restored from a checkpoint available, at offsets
+        // restoredLineFlag + (offset in restoredLines).
+        void setRestoredLines(const std::string_view lines) {
+            restoredLines = lines;
+        }
+
+        // Checks whether texts of lines of pending entrances have to be passed
+        // to keepLine, as they cannot be read again.
+        [[nodiscard]] bool keepsLines() const {
+            return pendingLines != nullptr;
+        }
+
+        // Keeps text of line at location, whose entrance is pending, if input
+        // cannot be read again.
+        void keepLine(const LineLocation &location, const std::string_view line) {
+            if (pendingLines != nullptr) {
+                pendingLines->keep(location, line);
+            }
+        }
+
+        // Releases line at location, whose entrance was paired or reported.
+        void releaseLine(const LineLocation &location) {
+            if (pendingLines != nullptr && !(location.first & restoredLineFlag)) {
+                pendingLines->release(location);
+            }
+        }
+
+        // Returns text of an already read or restored line located at location.
+        // Text of a line read from input which cannot be read again is only
+        // available while the line is kept.
+        [[nodiscard]] Line lineAt(const LineLocation &location) const {
+            const auto [offset, length] = location;
+
+            if (offset & restoredLineFlag) {
+                return Line(restoredLines.substr(offset & ~restoredLineFlag, length));
+            }
+
+            if (pendingLines != nullptr) {
+                return pendingLines->lineAt(location);
+            }
+
+            return inputLineAt(location);
+        }
+
+    protected:
+        // Makes lines available only while they are kept, for input which cannot be read again.
+        void keepPendingLines() {
+            pendingLines = std::make_unique<PendingLineStore>();
+        }
+
+        // Returns text of an already read line located at location.
+        [[nodiscard]] virtual Line inputLineAt(const LineLocation &location) const = 0;
+
+    private:
+        std::string_view restoredLines;
+        std::unique_ptr<PendingLineStore> pendingLines;
+    };
+
+    // Input read in blocks from a descriptor. Lines are re-read lazily from a
+    // seekable descriptor, while for input that cannot be re-read (e.g. pipe)
+    // only texts of pending entrances are kept. Followed input is a file which
+    // is being appended to, it never ends and only lines ended by a newline
+    // are read from it.
+    class DescriptorInput : public InputSource {
+    public:
+        // Lines are re-read from evidenceDescriptor, with offsets shifted by
+        // evidenceBase. If it is negative, lines are kept instead.
+        DescriptorInput(const int descriptor, const int evidenceDescriptor, const ByteOffset evidenceBase,
+                        const bool isFollowed = false)
+                : descriptor(descriptor), evidenceDescriptor(evidenceDescriptor),
+                  evidenceBase(evidenceBase), isFollowed(isFollowed), buffer(initialBufferSize) {
+
+            if (evidenceDescriptor < 0) {
+                keepPendingLines();
+            }
+        }
+
+        bool readLine(std::string_view &line, ByteOffset &offset) override {
+            while (true) {
+                const size_t newline = newlineScanner.find(buffer.data(), position, end);
+
+                if (newline < end || (endOfInput && position < end)) {
+                    line = std::string_view(buffer.data() + position, newline - position);
+                    offset = bufferOffset + position;
+                    position = newline < end ? newline + 1 : end;
+
+                    return true;
+                }
+
+                if (endOfInput || !readBlock()) {
+                    return false;
+                }
+            }
+        }
+
+        [[nodiscard]] bool isPersistent() const override {
+            return false;
+        }
+
+        void resumeAt(const ByteOffset offset) override {
+            if (seekTo(offset)) {
+                bufferOffset = offset;
+                position = end = 0;
+                newlineScanner.reset();
+            }
+        }
+
+    protected:
+        // Reads at most size bytes of input into data, like read.
+        virtual ssize_t readData(char *data, const size_t size) {
+            return read(descriptor, data, size);
+        }
+
+        // Makes the next read start at offset in input, if the input can be
+        // read again from its beginning. Returns false if it cannot.
+        virtual bool seekTo(const ByteOffset offset) {
+            return isFollowed && lseek(descriptor, static_cast<off_t>(evidenceBase + offset), SEEK_SET) >= 0;
+        }
+
+        [[nodiscard]] Line inputLineAt(const LineLocation &location) const override {
+            const auto [offset, length] = location;
+
+            Line line(length, '\0');
+
+            if (!readAllAt(evidenceDescriptor, line.data(), length, evidenceBase + offset)) {
+                line.clear();
+            }
+
+            return line;
+        }
+
+    private:
+        static constexpr size_t initialBufferSize = 1 << 20;
+        static constexpr auto followInterval = std::chrono::milliseconds(100);
+
+        // Moves unread part of the buffer to its beginning and appends next
+        // block of input. Returns false on read failure.
+        bool readBlock() {
+            newlineScanner.reset();
+
+            if (position > 0) {
+                std::memmove(buffer.data(), buffer.data() + position, end - position);
+                bufferOffset += position;
+                end -= position;
+                position = 0;
+            }
+
+            // Line longer than the whole buffer.
+            if (end == buffer.size()) {
+                buffer.resize(2 * buffer.size());
+            }
+
+            ssize_t bytesRead;
+
+            do {
+                bytesRead = readData(buffer.data() + end, buffer.size() - end);
+            } while (bytesRead < 0 && errno == EINTR);
+
+            // Wait for the followed file to grow.
+            if (bytesRead == 0 && isFollowed) {
+                std::this_thread::sleep_for(followInterval);
+
+                return true;
+            }
+
+            if (bytesRead <= 0) {
+                endOfInput = true;
+
+                return bytesRead == 0;
+            }
+
+            end += static_cast<size_t>(bytesRead);
+
+            return true;
+        }
+
+        const int descriptor;
+        const int evidenceDescriptor;
+        const ByteOffset evidenceBase;
+        const bool isFollowed;
+
+        std::vector<char> buffer;
+        NewlineScanner newlineScanner;
+
+        // Offset of the buffer beginning in input.
+        ByteOffset bufferOffset = 0;
+
+        // Unread part of the buffer is [position, end).
+        size_t position = 0;
+        size_t end = 0;
+
+        bool endOfInput = false;
+    };
+
+    // Opens standard input.
+    std::unique_ptr<InputSource> openStandardInput() {
+        struct stat fileStatus{};
+        const off_t start = lseek(STDIN_FILENO, 0, SEEK_CUR);
+
+        if (fstat(STDIN_FILENO, &fileStatus) == 0 && S_ISREG(fileStatus.st_mode) && start >= 0) {
+            return std::make_unique<DescriptorInput>(STDIN_FILENO, STDIN_FILENO, start);
+        }
+
+        return std::make_unique<DescriptorInput>(STDIN_FILENO, -1, 0);
+    }
+
+    // Gzip compressed input (possibly of many concatenated members), read as
+    // its decompressed text. Decompression runs on a separate thread, started
+    // with the first read, which passes blocks of text through a bounded
+    // queue, so it overlaps with processing. Decompressed text cannot be read
+    // again, so texts of pending entrances are kept.
+    class DecompressedInput : public DescriptorInput {
+    public:
+        // Compressed input is read from descriptor, closed with the input unless it is standard input.
+        explicit DecompressedInput(const int descriptor)
+                : DescriptorInput(-1, -1, 0), compressedDescriptor(descriptor) {}
+
+        ~DecompressedInput() override {
+            if (decompressor.joinable()) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    isStopped = true;
+                }
+
+                blocksChanged.notify_all();
+                decompressor.join();
+            }
+
+            if (compressedDescriptor != STDIN_FILENO) {
+                close(compressedDescriptor);
+            }
+        }
+
+        [[nodiscard]] bool hasFailed() const override {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            return failed;
+        }
+
+    protected:
+        ssize_t readData(char *data, const size_t size) override {
+            if (!decompressor.joinable()) {
+                decompressor = std::thread([this] { decompress(); });
+            }
+
+            while (true) {
+                if (blockPosition == block.size() && !takeBlock()) {
+                    if (hasFailed()) {
+                        errno = EIO;
+
+                        return -1;
+                    }
+
+                    return 0;
+                }
+
+                const size_t available = block.size() - blockPosition;
+
+                // Text before the offset of resumed input is skipped.
+                if (skipped < resumedOffset) {
+                    const size_t skipping = std::min<ByteOffset>(available, resumedOffset - skipped);
+
+                    blockPosition += skipping;
+                    skipped += skipping;
+
+                    continue;
+                }
+
+                const size_t bytesRead = std::min(available, size);
+
+                std::memcpy(data, block.data() + blockPosition, bytesRead);
+                blockPosition += bytesRead;
+
+                return static_cast<ssize_t>(bytesRead);
+            }
+        }
+
+        bool seekTo(const ByteOffset offset) override {
+            if (decompressor.joinable()) {
+                return false;
+            }
+
+            resumedOffset = offset;
+
+            return true;
+        }
+
+    private:
+        static constexpr size_t compressedBlockSize = 1 << 18;
+        static constexpr size_t blockSize = 1 << 20;
+        static constexpr size_t maxQueuedBlocks = 4;
+
+        // Decompresses the whole input into blocks of text.
+        void decompress() {
+            z_stream stream{};
+            std::vector<unsigned char> compressed(compressedBlockSize);
+            std::vector<char> text(blockSize);
+            size_t used = 0;
+
+            // Window bits increased by 32 detect gzip and zlib headers.
+            bool isFailed = inflateInit2(&stream, MAX_WBITS + 32) != Z_OK;
+            bool isMemberEnded = false;
+            bool isQueueOpen = !isFailed;
+
+            while (isQueueOpen && !isFailed) {
+                if (stream.avail_in == 0) {
+                    ssize_t bytesRead;
+
+                    do {
+                        bytesRead = read(compressedDescriptor, compressed.data(), compressed.size());
+                    } while (bytesRead < 0 && errno == EINTR);
+
+                    if (bytesRead <= 0) {
+                        // Input ending inside a member is truncated.
+                        isFailed = bytesRead < 0 || (!isMemberEnded && stream.total_in > 0);
+
+                        break;
+                    }
+
+                    stream.next_in = compressed.data();
+                    stream.avail_in = static_cast<uInt>(bytesRead);
+                }
+
+                // Next member follows.
+                if (isMemberEnded) {
+                    inflateReset(&stream);
+                    isMemberEnded = false;
+                }
+
+                stream.next_out = reinterpret_cast<unsigned char *>(text.data() + used);
+                stream.avail_out = static_cast<uInt>(text.size() - used);
+
+                const int result = inflate(&stream, Z_NO_FLUSH);
+
+                used = text.size() - stream.avail_out;
+                isMemberEnded = result == Z_STREAM_END;
+                isFailed = result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR;
+
+                if (used == text.size()) {
+                    isQueueOpen = putBlock(std::move(text));
+                    text.assign(blockSize, '\0');
+                    used = 0;
+                }
+            }
+
+            inflateEnd(&stream);
+
+            text.resize(used);
+
+            if (isQueueOpen && !text.empty()) {
+                putBlock(std::move(text));
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                isFinished = true;
+                failed = isFailed;
+            }
+
+            blocksChanged.notify_all();
+        }
+
+        // Puts block of text into the queue, waiting while it is full.
+        // Returns false if reading was stopped.
+        bool putBlock(std::vector<char> &&text) {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            blocksChanged.wait(lock, [this] { return blocks.size() < maxQueuedBlocks || isStopped; });
+
+            if (isStopped) {
+                return false;
+            }
+
+            blocks.push_back(std::move(text));
+            blocksChanged.notify_all();
+
+            return true;
+        }
+
+        // Takes next block of text from the queue, waiting while it is empty.
+        // Returns false at the end of text.
+        bool takeBlock() {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            blocksChanged.wait(lock, [this] { return !blocks.empty() || isFinished; });
+
+            if (blocks.empty()) {
+                return false;
+            }
+
+            block = std::move(blocks.front());
+            blockPosition = 0;
+            blocks.pop_front();
+            blocksChanged.notify_all();
+
+            return true;
+        }
+
+        const int compressedDescriptor;
+
+        std::thread decompressor;
+
+        // Blocks of text decompressed and not yet read, guarded by mutex.
+        mutable std::mutex mutex;
+        std::condition_variable blocksChanged;
+        std::deque<std::vector<char>> blocks;
+        bool isFinished = false;
+        bool isStopped = false;
+        bool failed = false;
+
+        // Block being read.
+        std::vector<char> block;
+        size_t blockPosition = 0;
+
+        // Offset from which input is resumed and length of text skipped so far.
+        ByteOffset resumedOffset = 0;
+        ByteOffset skipped = 0;
+    };
+
+    // Opens gzip compressed file with a given path, or standard input if it
+    // is nullptr. Returns nullptr on failure.
+    std::unique_ptr<InputSource> openDecompressedInput(const char *path) {
+        const int descriptor = path == nullptr ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+
+        if (descriptor < 0) {
+            return nullptr;
+        }
+
+        return std::make_unique<DecompressedInput>(descriptor);
+    }
+
+    // Opens file with a given path which is being appended to. Returns nullptr on failure.
+    std::unique_ptr<InputSource> openFollowedInput(const char *path) {
+        const int descriptor = open(path, O_RDONLY | O_CLOEXEC);
+
+        if (descriptor < 0) {
+            return nullptr;
+        }
+
+        // Descriptor stays open as long as the program runs.
+        return std::make_unique<DescriptorInput>(descriptor, descriptor, 0, true);
+    }
+
+    // Input file mapped into memory, read without copying.
+    class MappedInput : public InputSource {
+    public:
+        MappedInput(const char *data, const size_t size) : data(data), size(size) {}
+
+        MappedInput(const MappedInput &) = delete;
+        MappedInput &operator=(const MappedInput &) = delete;
+
+        ~MappedInput() override {
+            if (size > 0) {
+                munmap(const_cast<char *>(data), size);
+            }
+        }
+
+        bool readLine(std::string_view &line, ByteOffset &offset) override {
+            if (position == size) {
+                return false;
+            }
+
+            const size_t end = newlineScanner.find(data, position, size);
+
+            line = std::string_view(data + position, end - position);
+            offset = position;
+            position = end < size ? end + 1 : size;
+
+            return true;
+        }
+
+        [[nodiscard]] bool isPersistent() const override {
+            return true;
+        }
+
+        void resumeAt(const ByteOffset offset) override {
+            position = std::min(static_cast<size_t>(offset), size);
+        }
+
+    protected:
+        [[nodiscard]] Line inputLineAt(const LineLocation &location) const override {
+            const auto [offset, length] = location;
+
+            return Line(data + offset, length);
+        }
+
+    private:
+        const char *data;
+        const size_t size;
+        size_t position = 0;
+
+        NewlineScanner newlineScanner;
+    };
+
+    // Maps file with a given path into memory. Returns nullptr on failure.
+    std::unique_ptr<InputSource> openMappedInput(const char *path) {
+        const int descriptor = open(path, O_RDONLY);
+
+        if (descriptor < 0) {
+            return nullptr;
+        }
+
+        struct stat fileStatus{};
+        void *data = nullptr;
+
+        if (fstat(descriptor, &fileStatus) == 0 && fileStatus.st_size > 0) {
+            data = mmap(nullptr, fileStatus.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+            if (data != MAP_FAILED) {
+                madvise(data, fileStatus.st_size, MADV_SEQUENTIAL);
+            }
+        }
+
+        close(descriptor);
+
+        if (data == MAP_FAILED || (data == nullptr && fileStatus.st_size > 0)) {
+            return nullptr;
+        }
+
+        return std::make_unique<MappedInput>(static_cast<const char *>(data),
+                                             static_cast<size_t>(fileStatus.st_size));
+    }
+
+    // Creates Unix domain socket with a given path accepting connections,
+    // replacing socket left by a previous run. Returns -1 on failure.
+    int listenOnSocket(const char *path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+
+        if (std::strlen(path) >= sizeof(address.sun_path)) {
+            return -1;
+        }
+
+        std::strcpy(address.sun_path, path);
+
+        const int descriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if (descriptor < 0) {
+            return -1;
+        }
+
+        struct stat fileStatus{};
+
+        if (stat(path, &fileStatus) == 0 && S_ISSOCK(fileStatus.st_mode)) {
+            unlink(path);
+        }
+
+        if (bind(descriptor, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) < 0
+            || listen(descriptor, SOMAXCONN) < 0) {
+
+            close(descriptor);
+
+            return -1;
+        }
+
+        return descriptor;
+    }
+
+    // Connection to a Unix domain socket, with received text not yet consumed.
+    struct SocketConnection {
+        int descriptor;
+        std::string received;
+        size_t position = 0;
+        bool isClosed = false;
+
+        // Number of lines taken.
+        LineNumber lineNumber = 0;
+
+        // Receives available text. Connection is closed at its end or on failure.
+        void receive() {
+            std::array<char, 1 << 16> block{};
+            ssize_t bytesRead;
+
+            do {
+                bytesRead = read(descriptor, block.data(), block.size());
+            } while (bytesRead < 0 && errno == EINTR);
+
+            if (bytesRead <= 0) {
+                isClosed = true;
+            } else {
+                if (position > 0 && position >= received.size() / 2) {
+                    received.erase(0, position);
+                    position = 0;
+                }
+
+                received.append(block.data(), static_cast<size_t>(bytesRead));
+            }
+        }
+
+        // Takes next complete line, or the rest of text once connection is
+        // closed. Returns false if there is none.
+        bool takeLine(std::string_view &line) {
+            const size_t newline = received.find('\n', position);
+
+            if (newline == std::string::npos && (!isClosed || position == received.size())) {
+                return false;
+            }
+
+            const size_t lineEnd = newline == std::string::npos ? received.size() : newline;
+
+            line = std::string_view(received).substr(position, lineEnd - position);
+            position = newline == std::string::npos ? lineEnd : lineEnd + 1;
+            lineNumber++;
+
+            return true;
+        }
+    };
+
+    // Waits until the listener or any of connections can be read, accepts new
+    // connection and receives text from connections. Returns false on failure.
+    bool waitForConnections(const int listener, std::vector<SocketConnection> &connections,
+                            const int stopDescriptor = -1) {
+
+        std::vector<pollfd> descriptors{{listener, POLLIN, 0}};
+
+        for (const auto &connection : connections) {
+            descriptors.push_back({connection.descriptor, POLLIN, 0});
+        }
+
+        if (stopDescriptor >= 0) {
+            descriptors.push_back({stopDescriptor, POLLIN, 0});
+        }
+
+        if (poll(descriptors.data(), descriptors.size(), -1) < 0) {
+            return errno == EINTR;
+        }
+
+        for (size_t i = 0; i < connections.size(); i++) {
+            if (descriptors[i + 1].revents != 0) {
+                connections[i].receive();
+            }
+        }
+
+        if (descriptors[0].revents & POLLIN) {
+            const int descriptor = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+
+            if (descriptor >= 0) {
+                connections.push_back({descriptor, std::string()});
+            }
+        }
+
+        return true;
+    }
+
+    // Closes connections which are closed by clients and fully consumed.
+    void removeClosedConnections(std::vector<SocketConnection> &connections) {
+        connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                         [](const SocketConnection &connection) {
+                                             if (connection.isClosed
+                                                 && connection.position == connection.received.size()) {
+                                                 close(connection.descriptor);
+
+                                                 return true;
+                                             }
+
+                                             return false;
+                                         }),
+                          connections.end());
+    }
+
+    // Lines sent by clients connected to a Unix domain socket, taken from
+    // connections in turns. Lines cannot be read again, so texts of pending
+    // entrances are kept. Offsets count bytes of lines read from all
+    // connections. Input never ends.
+    class SocketInput : public InputSource {
+    public:
+        explicit SocketInput(const int listener) : listener(listener) {
+            keepPendingLines();
+        }
+
+        SocketInput(const SocketInput &) = delete;
+        SocketInput &operator=(const SocketInput &) = delete;
+
+        ~SocketInput() override {
+            for (const auto &connection : connections) {
+                close(connection.descriptor);
+            }
+
+            close(listener);
+        }
+
+        bool readLine(std::string_view &line, ByteOffset &offset) override {
+            while (true) {
+                for (size_t i = 0; i < connections.size(); i++) {
+                    nextConnection = (nextConnection + 1) % connections.size();
+
+                    if (connections[nextConnection].takeLine(line)) {
+                        offset = nextOffset;
+                        nextOffset += line.size() + 1;
+
+                        return true;
+                    }
+                }
+
+                removeClosedConnections(connections);
+
+                if (!waitForConnections(listener, connections)) {
+                    return false;
+                }
+            }
+        }
+
+        [[nodiscard]] bool isPersistent() const override {
+            return false;
+        }
+
+    protected:
+        // Lines which are not kept are not available.
+        [[nodiscard]] Line inputLineAt([[maybe_unused]] const LineLocation &location) const override {
+            return Line();
+        }
+
+    private:
+        const int listener;
+
+        std::vector<SocketConnection> connections;
+        size_t nextConnection = 0;
+        ByteOffset nextOffset = 0;
+    };
+
+    // Opens input accepting connections on Unix domain socket with a given
+    // path. Returns nullptr on failure.
+    std::unique_ptr<InputSource> openSocketInput(const char *path) {
+        const int listener = listenOnSocket(path);
+
+        if (listener < 0) {
+            return nullptr;
+        }
+
+        return std::make_unique<SocketInput>(listener);
+    }
+}
+
+// Toll counter state.
+namespace {
+    // Line found to be erroneous after it had been accepted.
+    struct ErroneousLine {
+        LineNumber lineNumber;
+        LineLocation location;
+    };
+
+    // Outcome of a road entrance for pending entrances of the car.
+    struct EntranceOutcome {
+        // Previous entrance of the car, if it turns out to be erroneous.
+        std::optional<ErroneousLine> erroneousLine;
+
+        // Location of previous entrance of the car, if the entrance is paired
+        // with it. Otherwise the entrance itself becomes pending.
+        std::optional<LineLocation> pairedLocation;
+    };
+
+    // Statistics structures updated by road entrances.
+    struct TollStatistics {
+        // Map licensePlate -> ((roadNumber, roadCategory), mileage, lineNumber, lineLocation).
+        UnpairedEntrance unpairedCarEntrances;
+
+        // Map licensePlate -> (roadCategory -> mileage).
+        CarStatistics mileagesOfCarsByRoadCategories;
+
+        // Map (roadNumber, roadCategory) -> mileage.
+        RoadStatistics mileagesOfRoads;
+
+        // Cars and roads ordered by mileage.
+        MileageRankings rankings;
+    };
+
+    // Returns mileage as optional, none if it is nullptr.
+    inline std::optional<Mileage> optionalMileage(const Mileage *mileage) {
+        return mileage == nullptr ? std::nullopt : std::optional<Mileage>(*mileage);
+    }
+
+    // Adds distance driven by a car on a road to statistics and rankings.
+    void addDistance(TollStatistics &statistics, const LicensePlate &licensePlate,
+                     const Road &road, const Mileage distance) {
+
+        auto &[unpairedCarEntrances, mileagesOfCarsByRoadCategories, mileagesOfRoads, rankings] = statistics;
+
+        const RoadCategory roadCategory = road.second;
+        const size_t categoryIndex = roadCategoryToIndex(roadCategory);
+
+        MileageByRoadCategory &carMileage = mileagesOfCarsByRoadCategories[licensePlate];
+
+        if (rankings.getCapacity() == 0) {
+            carMileage.add(roadCategory, distance);
+            mileagesOfRoads.add(road, distance);
+
+            return;
+        }
+
+        std::optional<Mileage> previousTotal;
+
+        if (!carMileage.empty()) {
+            previousTotal = carMileage.total();
+        }
+
+        const std::optional<Mileage> previousCarMileage = optionalMileage(carMileage.find(roadCategory));
+        const std::optional<Mileage> previousRoadMileage = optionalMileage(mileagesOfRoads.find(road));
+
+        carMileage.add(roadCategory, distance);
+        mileagesOfRoads.add(road, distance);
+
+        rankings.carsByTotalMileage.update(licensePlate, previousTotal, carMileage.total());
+        rankings.carsByRoadCategory[categoryIndex].update(licensePlate, previousCarMileage,
+                                                          *carMileage.find(roadCategory));
+        rankings.roadsByRoadCategory[categoryIndex].update(road, previousRoadMileage,
+                                                           *mileagesOfRoads.find(road));
+    }
+
+    // Ranks at most capacity cars and roads with the highest mileages from
+    // statistics and maintains the rankings from then on.
+    void rankAllMileages(TollStatistics &statistics, const size_t capacity) {
+        auto &rankings = statistics.rankings;
+
+        rankings.reset(capacity);
+
+        statistics.mileagesOfCarsByRoadCategories.forEach(
+                [&rankings](const LicensePlate &licensePlate, const MileageByRoadCategory &carMileage) {
+                    rankings.carsByTotalMileage.update(licensePlate, std::nullopt, carMileage.total());
+
+                    carMileage.forEach([&](const RoadCategory roadCategory, const Mileage mileage) {
+                        rankings.carsByRoadCategory[roadCategoryToIndex(roadCategory)]
+                                .update(licensePlate, std::nullopt, mileage);
+                    });
+                });
+
+        for (const auto &[road, mileage] : statistics.mileagesOfRoads) {
+            rankings.roadsByRoadCategory[roadCategoryToIndex(road.second)].update(road, std::nullopt, mileage);
+        }
+    }
+}
+
+// Checkpoints of toll counter state.
+namespace {
+    // Set by signal handler when a checkpoint is requested.
+    volatile std::sig_atomic_t checkpointRequested = 0;
+
+    // Signal handler requesting a checkpoint.
+    extern "C" void requestCheckpoint(int) {
+        checkpointRequested = 1;
+    }
+
+    // Checkpoint file consists of a header followed by arrays of road, car and
+    // unpaired entrance records and by text of lines of unpaired entrances.
+    // Integers are stored in native byte order.
+    constexpr std::array<char, 8> checkpointMagic = {'N', 'O', 'D', 'C', 'K', 'P', 'T', '\0'};
+    constexpr uint32_t checkpointVersion = 1;
+
+    struct CheckpointHeader {
+        std::array<char, 8> magic;
+        uint32_t version;
+        uint32_t headerSize;
+
+        // Number of the last processed line and offset of the next one in input.
+        uint64_t lineNumber;
+        uint64_t nextOffset;
+
+        uint64_t roadsCount;
+        uint64_t carsCount;
+        uint64_t unpairedCount;
+        uint64_t linesSize;
+    };
+
+    struct CheckpointRoad {
+        uint64_t mileage;
+        uint32_t roadNumber;
+        char roadCategory;
+        std::array<char, 3> padding;
+    };
+
+    struct CheckpointLicensePlate {
+        std::array<char, LicensePlate::maxLength> characters;
+        uint8_t length;
+    };
+
+    struct CheckpointCar {
+        CheckpointLicensePlate licensePlate;
+        std::array<char, 4> padding;
+        std::array<uint64_t, roadCategoriesCount> mileages;
+        std::array<uint8_t, roadCategoriesCount> present;
+        std::array<char, 6> padding2;
+    };
+
+    struct CheckpointUnpairedEntrance {
+        CheckpointLicensePlate licensePlate;
+        uint32_t roadNumber;
+        uint64_t mileage;
+        uint64_t lineNumber;
+
+        // Location of line text after all records.
+        uint64_t lineOffset;
+        uint64_t lineLength;
+
+        char roadCategory;
+        std::array<char, 7> padding;
+    };
+
+    static_assert(std::is_trivially_copyable_v<CheckpointHeader> && sizeof(CheckpointHeader) == 64);
+    static_assert(std::is_trivially_copyable_v<CheckpointRoad> && sizeof(CheckpointRoad) == 16);
+    static_assert(std::is_trivially_copyable_v<CheckpointCar> && sizeof(CheckpointCar) == 40);
+    static_assert(std::is_trivially_copyable_v<CheckpointUnpairedEntrance> && sizeof(CheckpointUnpairedEntrance) == 56);
+
+    inline CheckpointLicensePlate licensePlateToCheckpoint(const LicensePlate &licensePlate) {
+        CheckpointLicensePlate record{};
+        const std::string_view view = licensePlate.view();
+
+        std::memcpy(record.characters.data(), view.data(), view.size());
+        record.length = static_cast<uint8_t>(view.size());
+
+        return record;
+    }
+
+    // Writes record as raw bytes.
+    template<typename Record>
+    void writeRecord(OutputWriter &output, const Record &record) {
+        output << std::string_view(reinterpret_cast<const char *>(&record), sizeof(record));
+    }
+
+    // Writes checkpoint of statistics of all shards, replacing file at path
+    // only once the whole checkpoint is written. Returns false on failure.
+    bool writeCheckpoint(const char *path, const std::vector<const TollStatistics *> &shards,
+                         const InputSource &input, const LineNumber lineNumber, const ByteOffset nextOffset) {
+
+        const std::string temporaryPath = std::string(path) + ".tmp";
+        const int descriptor = open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (descriptor < 0) {
+            return false;
+        }
+
+        RoadStatistics mileagesOfRoads;
+        CheckpointHeader header{checkpointMagic, checkpointVersion, sizeof(CheckpointHeader),
+                                lineNumber, nextOffset, 0, 0, 0, 0};
+
+        for (const TollStatistics *statistics : shards) {
+            mileagesOfRoads.merge(statistics->mileagesOfRoads);
+            header.carsCount += statistics->mileagesOfCarsByRoadCategories.size();
+            header.unpairedCount += statistics->unpairedCarEntrances.size();
+
+            statistics->unpairedCarEntrances.forEach([&header](const LicensePlate &, const auto &entrance) {
+                header.linesSize += std::get<LineLocation>(entrance).second;
+            });
+        }
+
+        for ([[maybe_unused]] const auto &road : mileagesOfRoads) {
+            header.roadsCount++;
+        }
+
+        bool failed;
+
+        {
+            OutputWriter output(descriptor);
+
+            writeRecord(output, header);
+
+            for (const auto &[road, mileage] : mileagesOfRoads) {
+                writeRecord(output, CheckpointRoad{mileage, road.first, road.second, {}});
+            }
+
+            for (const TollStatistics *statistics : shards) {
+                statistics->mileagesOfCarsByRoadCategories.forEach(
+                        [&output](const LicensePlate &licensePlate, const MileageByRoadCategory &carMileage) {
+                            CheckpointCar record{licensePlateToCheckpoint(licensePlate), {}, {}, {}, {}};
+
+                            carMileage.forEach([&record](const RoadCategory roadCategory, const Mileage mileage) {
+                                record.mileages[roadCategoryToIndex(roadCategory)] = mileage;
+                                record.present[roadCategoryToIndex(roadCategory)] = 1;
+                            });
+
+                            writeRecord(output, record);
+                        });
+            }
+
+            uint64_t lineOffset = 0;
+
+            for (const TollStatistics *statistics : shards) {
+                statistics->unpairedCarEntrances.forEach([&](const LicensePlate &licensePlate, const auto &entrance) {
+                    const auto &[road, mileage, entranceLineNumber, location] = entrance;
+
+                    writeRecord(output, CheckpointUnpairedEntrance{licensePlateToCheckpoint(licensePlate),
+                                                                   road.first, mileage, entranceLineNumber,
+                                                                   lineOffset, location.second,
+                                                                   road.second, {}});
+
+                    lineOffset += location.second;
+                });
+            }
+
+            for (const TollStatistics *statistics : shards) {
+                statistics->unpairedCarEntrances.forEach([&](const LicensePlate &, const auto &entrance) {
+                    output << input.lineAt(std::get<LineLocation>(entrance));
+                });
+            }
+
+            output.flush();
+            failed = output.hasFailed();
+        }
+
+        failed |= fsync(descriptor) != 0;
+        failed |= close(descriptor) != 0;
+
+        return !failed && rename(temporaryPath.c_str(), path) == 0;
+    }
+
+    // Writes checkpoints periodically and when requested by a signal.
+    class Checkpointer {
+    public:
+        // Checkpoints are written to path, if it is not nullptr, every interval
+        // lines, if it is not 0, starting from line lineNumber.
+        Checkpointer(const char *path, const LineNumber interval, const LineNumber lineNumber)
+                : path(path), interval(interval), lastLineNumber(lineNumber) {}
+
+        [[nodiscard]] bool isEnabled() const {
+            return path != nullptr;
+        }
+
+        // Checks whether checkpoint should be written after line lineNumber.
+        [[nodiscard]] bool isDue(const LineNumber lineNumber) const {
+            return path != nullptr
+                   && (checkpointRequested || (interval > 0 && lineNumber - lastLineNumber >= interval));
+        }
+
+        void write(const std::vector<const TollStatistics *> &shards, const InputSource &input,
+                   const LineNumber lineNumber, const ByteOffset nextOffset) {
+
+            checkpointRequested = 0;
+            lastLineNumber = lineNumber;
+
+            // Reported after buffered errors of lines preceding the checkpoint.
+            if (!writeCheckpoint(path, shards, input, lineNumber, nextOffset)) {
+                OutputWriter &output = errorOutput();
+
+                output << "Cannot write checkpoint " << path;
+                output.endLine();
+                output.flush();
+            }
+        }
+
+    private:
+        const char *path;
+        const LineNumber interval;
+        LineNumber lastLineNumber;
+    };
+
+    // Checkpoint file mapped into memory. Text of lines of restored unpaired
+    // entrances stays in the mapping.
+    class CheckpointFile {
+    public:
+        CheckpointFile(const char *data, const size_t size) : data(data), size(size) {
+            std::memcpy(&header, data, sizeof(header));
+        }
+
+        CheckpointFile(const CheckpointFile &) = delete;
+        CheckpointFile &operator=(const CheckpointFile &) = delete;
+
+        ~CheckpointFile() {
+            munmap(const_cast<char *>(data), size);
+        }
+
+        [[nodiscard]] LineNumber getLineNumber() const {
+            return header.lineNumber;
+        }
+
+        [[nodiscard]] ByteOffset getNextOffset() const {
+            return header.nextOffset;
+        }
+
+        // Checks whether header and sizes of all parts agree with file size.
+        [[nodiscard]] bool isValid() const {
+            const uint64_t recordsSize = header.roadsCount * sizeof(CheckpointRoad)
+                                         + header.carsCount * sizeof(CheckpointCar)
+                                         + header.unpairedCount * sizeof(CheckpointUnpairedEntrance);
+
+            return header.magic == checkpointMagic && header.version == checkpointVersion
+                   && header.headerSize == sizeof(CheckpointHeader)
+                   && header.roadsCount <= size && header.carsCount <= size && header.unpairedCount <= size
+                   && header.linesSize <= size && sizeof(header) + recordsSize + header.linesSize == size;
+        }
+
+        // Returns text of lines of unpaired entrances.
+        [[nodiscard]] std::string_view lines() const {
+            return {data + size - header.linesSize, header.linesSize};
+        }
+
+        // Restores statistics, putting roads into roadStatistics and cars into
+        // statisticsOf(licensePlate). Returns false if records are invalid.
+        template<typename StatisticsOf>
+        bool restore(TollStatistics &roadStatistics, StatisticsOf &&statisticsOf) const {
+            const char *position = data + sizeof(header);
+
+            for (uint64_t i = 0; i < header.roadsCount; i++) {
+                const auto record = readRecord<CheckpointRoad>(position);
+
+                if (record.roadNumber < 1 || record.roadNumber > 999
+                    || (record.roadCategory != 'A' && record.roadCategory != 'S')) {
+
+                    return false;
+                }
+
+                roadStatistics.mileagesOfRoads.add({record.roadNumber, record.roadCategory}, record.mileage);
+            }
+
+            for (uint64_t i = 0; i < header.carsCount; i++) {
+                const auto record = readRecord<CheckpointCar>(position);
+                LicensePlate licensePlate;
+
+                if (!checkpointToLicensePlate(record.licensePlate, licensePlate)) {
+                    return false;
+                }
+
+                MileageByRoadCategory &carMileage =
+                        statisticsOf(licensePlate).mileagesOfCarsByRoadCategories[licensePlate];
+
+                for (size_t index = 0; index < roadCategoriesCount; index++) {
+                    if (record.present[index]) {
+                        carMileage.add(indexToRoadCategory(index), record.mileages[index]);
+                    }
+                }
+            }
+
+            for (uint64_t i = 0; i < header.unpairedCount; i++) {
+                const auto record = readRecord<CheckpointUnpairedEntrance>(position);
+                LicensePlate licensePlate;
+
+                if (!checkpointToLicensePlate(record.licensePlate, licensePlate)
+                    || record.lineOffset > header.linesSize || record.lineLength > header.linesSize - record.lineOffset) {
+
+                    return false;
+                }
+
+                const LineLocation location = {InputSource::restoredLineFlag | record.lineOffset,
+                                               record.lineLength};
+
+                statisticsOf(licensePlate).unpairedCarEntrances[licensePlate] = {
+                        Road(record.roadNumber, record.roadCategory), record.mileage, record.lineNumber, location};
+            }
+
+            return true;
+        }
+
+    private:
+        template<typename Record>
+        static Record readRecord(const char *&position) {
+            Record record;
+            std::memcpy(&record, position, sizeof(record));
+            position += sizeof(record);
+
+            return record;
+        }
+
+        static bool checkpointToLicensePlate(const CheckpointLicensePlate &record, LicensePlate &licensePlate) {
+            if (record.length < 1 || record.length > LicensePlate::maxLength) {
+                return false;
+            }
+
+            licensePlate = LicensePlate(std::string_view(record.characters.data(), record.length));
+
+            return true;
+        }
+
+        const char *data;
+        const size_t size;
+        CheckpointHeader header{};
+    };
+
+    // Maps checkpoint file with a given path into memory. Returns nullptr on failure.
+    std::unique_ptr<CheckpointFile> openCheckpoint(const char *path) {
+        const int descriptor = open(path, O_RDONLY);
+
+        if (descriptor < 0) {
+            return nullptr;
+        }
+
+        struct stat fileStatus{};
+        void *data = MAP_FAILED;
+
+        if (fstat(descriptor, &fileStatus) == 0
+            && static_cast<size_t>(fileStatus.st_size) >= sizeof(CheckpointHeader)) {
+
+            data = mmap(nullptr, fileStatus.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        }
+
+        close(descriptor);
+
+        if (data == MAP_FAILED) {
+            return nullptr;
+        }
+
+        auto checkpoint = std::make_unique<CheckpointFile>(static_cast<const char *>(data),
+                                                           static_cast<size_t>(fileStatus.st_size));
+
+        return checkpoint->isValid() ? std::move(checkpoint) : nullptr;
+    }
+}
+
+// Processing line events.
+namespace {
+    // Processes road entrance by updating information stored in statistics structures.
+    EntranceOutcome processRoadEntrance(TollStatistics &statistics,
+                                        const LicensePlate &licensePlate,
+                                        const Road &road,
+                                        const Mileage mileage,
+                                        const LineLocation &location,
+                                        const LineNumber lineNumber) {
+
+        auto &unpairedCarEntrances = statistics.unpairedCarEntrances;
+
+        EntranceOutcome outcome;
+
+        auto *unpairedEntrance = unpairedCarEntrances.find(licensePlate);
+
+        if (unpairedEntrance != nullptr) {
+            const auto [previousRoad,
+            previousMileage,
+            previousLineNumber,
+            previousLocation] = *unpairedEntrance;
+
+            // Pair of information found, update structures.
+            if (road == previousRoad) {
+                Mileage distance = std::max(mileage, previousMileage) -
+                                   std::min(mileage, previousMileage);
+
+                addDistance(statistics, licensePlate, road, distance);
+
+                unpairedCarEntrances.erase(licensePlate);
+                outcome.pairedLocation = previousLocation;
+            } else {
+                // Previous information turns out to be wrong.
+                outcome.erroneousLine = {previousLineNumber, previousLocation};
+                *unpairedEntrance = {road, mileage, lineNumber, location};
+            }
+        } else {
+            // If there was no previous information, simply insert current one.
+            unpairedCarEntrances[licensePlate] = {road, mileage, lineNumber, location};
+        }
+
+        return outcome;
+    }
+
+    // Processes car mileage query.
+    void processCarMileageQuery(OutputWriter &output,
+                                const CarStatistics &mileagesOfCarsByRoadCategories,
+                                const LicensePlate &licensePlate) {
+
+        outputCarMileageByRoadCategories(output, mileagesOfCarsByRoadCategories, licensePlate);
+    }
+
+    // Processes top query.
+    void processTopQuery(OutputWriter &output, const TollStatistics &statistics,
+                         const size_t count, const RoadCategory roadCategory) {
+
+        const auto &carsByMileage = statistics.mileagesOfCarsByRoadCategories;
+
+        outputTopMileages(output, {&statistics.rankings.carsRanking(roadCategory)},
+                          [&carsByMileage](const LicensePlate &licensePlate) -> const MileageByRoadCategory & {
+                              return *carsByMileage.find(licensePlate);
+                          },
+                          statistics.rankings.roadsRankings(roadCategory), count);
+    }
+
+    // Processes road mileage query.
+    void processRoadMileageQuery(OutputWriter &output, const RoadStatistics &mileagesOfRoads,
+                                 const Road &road) {
+
+        outputRoadMileage(output, mileagesOfRoads, road);
+    }
+
+    // Checks whether event is a query, which does not change statistics.
+    inline bool isQuery(const LineEvent &event) {
+        return event.type == LineEventType::AllStatisticsQuery
+               || event.type == LineEventType::StatisticsQuery
+               || event.type == LineEventType::TopQuery;
+    }
+
+    // Processes query of any type.
+    void processQuery(OutputWriter &output, const TollStatistics &statistics, const LineEvent &event) {
+        switch (event.type) {
+            case LineEventType::AllStatisticsQuery:
+                outputMileagesOfCarsByRoadCategories(output, statistics.mileagesOfCarsByRoadCategories);
+                outputMileagesOfRoads(output, statistics.mileagesOfRoads);
+                break;
+            case LineEventType::StatisticsQuery:
+                if (event.isCarQuery) {
+                    processCarMileageQuery(output, statistics.mileagesOfCarsByRoadCategories,
+                                           event.licensePlate);
+                }
+
+                if (event.isRoadQuery) {
+                    processRoadMileageQuery(output, statistics.mileagesOfRoads, event.road);
+                }
+                break;
+            case LineEventType::TopQuery:
+                processTopQuery(output, statistics, event.topCount, event.topRoadCategory);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Reads next line from input, timing it as the reading stage.
+    inline bool readTimedLine(InputSource &input, std::string_view &line, ByteOffset &offset,
+                              StageCounters &counters) {
+
+        StageTimer timer(counters, Stage::Reading);
+
+        return input.readLine(line, offset);
+    }
+
+    // Parses line, timing it as the parsing stage.
+    inline LineEvent parseTimedLine(const std::string_view line, StageCounters &counters) {
+        StageTimer timer(counters, Stage::Parsing);
+
+        LineEvent event = parseLine(line);
+
+        if (instrumented && event.type == LineEventType::Erroneous) {
+            counters.erroneousLines++;
+        }
+
+        return event;
+    }
+
+    // Processes road entrance, timing it as the updating stage and counting its outcome.
+    EntranceOutcome processCountedRoadEntrance(TollStatistics &statistics, const LineEvent &event,
+                                               const LineLocation &location, const LineNumber lineNumber,
+                                               StageCounters &counters) {
+
+        StageTimer timer(counters, Stage::Updating);
+
+        auto outcome = processRoadEntrance(statistics, event.licensePlate, event.road, event.mileage,
+                                           location, lineNumber);
+
+        if (instrumented) {
+            counters.entrances++;
+            counters.revealedErrors += outcome.erroneousLine.has_value();
+            counters.pairedEntrances += outcome.pairedLocation.has_value();
+            counters.noteUnpairedEntrances(statistics.unpairedCarEntrances.size());
+        }
+
+        return outcome;
+    }
+
+    // Processes query, timing it as the output stage and recording its latency.
+    // Rankings are built by the first top query.
+    void processCountedQuery(OutputWriter &output, TollStatistics &statistics, const LineEvent &event,
+                             StageCounters &counters) {
+
+        StageTimer timer(counters, Stage::Output);
+
+        if (event.type == LineEventType::TopQuery && statistics.rankings.getCapacity() < event.topCount) {
+            rankAllMileages(statistics, event.topCount);
+        }
+
+        processQuery(output, statistics, event);
+
+        if (instrumented) {
+            counters.queries++;
+            instrumentation().addQueryLatency(event.type, timer.elapsed());
+        }
+    }
+
+    // Performs operations requested by event recognised in line lineNumber,
+    // located at offset in input.
+    void processLineEvent(InputSource &input, TollStatistics &statistics, const LineEvent &event,
+                          const std::string_view line, const ByteOffset offset, const LineNumber lineNumber,
+                          StageCounters &counters) {
+
+        switch (event.type) {
+            case LineEventType::Empty:
+                // Ignore empty lines.
+                break;
+            case LineEventType::RoadEntrance: {
+                const LineLocation location = {offset, line.size()};
+                const auto [erroneousLine, pairedLocation] = processCountedRoadEntrance(statistics, event, location,
+                                                                                        lineNumber, counters);
+
+                if (pairedLocation) {
+                    input.releaseLine(*pairedLocation);
+                } else {
+                    input.keepLine(location, line);
+                }
+
+                if (erroneousLine) {
+                    StageTimer timer(counters, Stage::Output);
+
+                    outputErroneousLine(input.lineAt(erroneousLine->location), erroneousLine->lineNumber);
+                    input.releaseLine(erroneousLine->location);
+                }
+                break;
+            }
+            case LineEventType::AllStatisticsQuery:
+            case LineEventType::StatisticsQuery:
+            case LineEventType::TopQuery:
+                processCountedQuery(answerOutput(), statistics, event, counters);
+                break;
+            case LineEventType::Erroneous: {
+                StageTimer timer(counters, Stage::Output);
+
+                outputErroneousLine(line, lineNumber);
+                break;
+            }
+        }
+    }
+
+    // Processes the rest of input, starting at nextOffset after line lineNumber,
+    // line by line on a single thread. Each line is processed holding
+    // statisticsMutex, if it is given.
+    void processSequentially(InputSource &input, TollStatistics &statistics,
+                             LineNumber lineNumber, ByteOffset nextOffset, Checkpointer &checkpointer,
+                             std::mutex *statisticsMutex = nullptr) {
+
+        StageCounters counters;
+
+        std::string_view line;
+        ByteOffset offset;
+        while (readTimedLine(input, line, offset, counters)) {
+            std::optional<std::lock_guard<std::mutex>> statisticsLock;
+
+            if (statisticsMutex != nullptr) {
+                statisticsLock.emplace(*statisticsMutex);
+            }
+
+            lineNumber++;
+            nextOffset = offset + line.size() + 1;
+            counters.lines++;
+
+            // Recognise line and perform requested operations.
+            processLineEvent(input, statistics, parseTimedLine(line, counters), line, offset, lineNumber,
+                             counters);
+
+            if (checkpointer.isDue(lineNumber)) {
+                checkpointer.write({&statistics}, input, lineNumber, nextOffset);
+            }
+
+            instrumentation().dumpIfRequested(counters);
+        }
+
+        if (checkpointer.isEnabled()) {
+            checkpointer.write({&statistics}, input, lineNumber, nextOffset);
+        }
+
+        instrumentation().add(counters);
+    }
+}
+
+// Processing line events in a pipeline of threads.
+namespace {
+    // Size of a cache line, which separates data written by different threads.
+    constexpr size_t cacheLineSize = 64;
+
+    // Bounded lock-free queue passing elements from a single producer thread
+    // to a single consumer thread. Each side caches the last seen index of
+    // the other one, so indices shared between cores are loaded only when
+    // the queue seems full or empty.
+    template<typename Element, size_t capacity>
+    class SpscRing {
+        static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "Capacity must be a power of two.");
+
+    public:
+        // Appends element, waiting while the queue is full.
+        void push(Element element) {
+            const size_t tail = producer.tail.load(std::memory_order_relaxed);
+
+            waitUntil([&] {
+                if (tail - producer.cachedHead == capacity) {
+                    producer.cachedHead = consumer.head.load(std::memory_order_acquire);
+                }
+
+                return tail - producer.cachedHead < capacity;
+            });
+
+            elements[tail % capacity] = std::move(element);
+            producer.tail.store(tail + 1, std::memory_order_release);
+        }
+
+        // Removes the first element, waiting while the queue is empty.
+        Element pop() {
+            const size_t head = consumer.head.load(std::memory_order_relaxed);
+
+            waitUntil([&] {
+                if (head == consumer.cachedTail) {
+                    consumer.cachedTail = producer.tail.load(std::memory_order_acquire);
+                }
+
+                return head != consumer.cachedTail;
+            });
+
+            Element element = std::move(elements[head % capacity]);
+            consumer.head.store(head + 1, std::memory_order_release);
+
+            return element;
+        }
+
+    private:
+        static constexpr size_t yieldingAttempts = 1000;
+        static constexpr auto sleepingInterval = std::chrono::microseconds(50);
+
+        // Waits until condition holds, yielding the processor at first and
+        // then sleeping, so a stage waiting for long does not occupy a core.
+        template<typename Condition>
+        static void waitUntil(Condition &&condition) {
+            for (size_t attempt = 0; !condition(); attempt++) {
+                if (attempt < yieldingAttempts) {
+                    std::this_thread::yield();
+                } else {
+                    std::this_thread::sleep_for(sleepingInterval);
+                }
+            }
+        }
+
+        // Indices only grow, element of index i is stored at i % capacity.
+        struct alignas(cacheLineSize) ProducerIndices {
+            std::atomic<size_t> tail{0};
+            size_t cachedHead = 0;
+        };
+
+        struct alignas(cacheLineSize) ConsumerIndices {
+            std::atomic<size_t> head{0};
+            size_t cachedTail = 0;
+        };
+
+        ProducerIndices producer;
+        ConsumerIndices consumer;
+
+        std::array<Element, capacity> elements{};
+    };
+
+    // Maximum number of lines in a batch and total length of lines copied
+    // into it, after which the batch is passed to the next stage.
+    constexpr size_t pipelineBatchLines = 1024;
+    constexpr size_t pipelineBatchText = 1 << 16;
+
+    // Number of batches in the pipeline, which bounds its memory use.
+    constexpr size_t pipelineBatches = 16;
+
+    // Consecutive lines passed together through stages of the pipeline,
+    // with events recognised in them once they are parsed.
+    struct PipelineBatch {
+        // Copies of lines, if input does not keep them valid.
+        std::string text;
+
+        std::vector<std::string_view> lines;
+        std::vector<ByteOffset> offsets;
+        std::vector<LineEvent> events;
+
+        // Whether input ends after the batch.
+        bool isLast = false;
+    };
+
+    // Processes input on three threads: the first one reads and splits lines,
+    // the second one parses them into events and the calling thread updates
+    // statistics and writes output, so reading and parsing of next lines
+    // overlap with processing of previous ones. Batches of lines circulate
+    // through lock-free rings between consecutive stages and back to the
+    // first one. Statistics stay owned by a single thread, so output is
+    // identical to sequential processing.
+    class PipelinedTollCounter {
+    public:
+        PipelinedTollCounter(InputSource &input, TollStatistics &statistics)
+                : input(input), statistics(statistics), batches(pipelineBatches) {
+
+            for (auto &batch : batches) {
+                freeBatches.push(&batch);
+            }
+        }
+
+        // Processes the rest of input, starting at nextOffset after line lineNumber.
+        void process(const LineNumber lineNumber, const ByteOffset nextOffset, Checkpointer &checkpointer) {
+            std::thread reader([this] { readLines(); });
+            std::thread parser([this] { parseLines(); });
+
+            processEvents(lineNumber, nextOffset, checkpointer);
+
+            reader.join();
+            parser.join();
+        }
+
+    private:
+        // First stage, fills free batches with lines of input.
+        void readLines() {
+            const bool copyLines = !input.isPersistent();
+
+            StageCounters counters;
+            bool endOfInput = false;
+
+            while (!endOfInput) {
+                PipelineBatch &batch = *freeBatches.pop();
+
+                batch.text.clear();
+                batch.lines.clear();
+                batch.offsets.clear();
+
+                std::string_view line;
+                ByteOffset offset;
+
+                while (batch.lines.size() < pipelineBatchLines && batch.text.size() < pipelineBatchText
+                       && !(endOfInput = !readTimedLine(input, line, offset, counters))) {
+
+                    if (copyLines) {
+                        batch.text += line;
+                    }
+
+                    batch.lines.push_back(line);
+                    batch.offsets.push_back(offset);
+                }
+
+                // Copied lines are pointed to once text stops growing.
+                if (copyLines) {
+                    const char *copy = batch.text.data();
+
+                    for (auto &copiedLine : batch.lines) {
+                        copiedLine = std::string_view(copy, copiedLine.size());
+                        copy += copiedLine.size();
+                    }
+                }
+
+                batch.isLast = endOfInput;
+                readBatches.push(&batch);
+            }
+
+            instrumentation().add(counters);
+        }
+
+        // Second stage, recognises events in lines of batches.
+        void parseLines() {
+            StageCounters counters;
+            bool isLast = false;
+
+            while (!isLast) {
+                PipelineBatch &batch = *readBatches.pop();
+
+                batch.events.resize(batch.lines.size());
+
+                for (size_t index = 0; index < batch.lines.size(); index++) {
+                    batch.events[index] = parseTimedLine(batch.lines[index], counters);
+                }
+
+                isLast = batch.isLast;
+                parsedBatches.push(&batch);
+            }
+
+            instrumentation().add(counters);
+        }
+
+        // Last stage, performs operations requested by events and frees batches.
+        void processEvents(LineNumber lineNumber, ByteOffset nextOffset, Checkpointer &checkpointer) {
+            StageCounters counters;
+            bool isLast = false;
+
+            while (!isLast) {
+                PipelineBatch &batch = *parsedBatches.pop();
+
+                for (size_t index = 0; index < batch.lines.size(); index++) {
+                    const std::string_view line = batch.lines[index];
+                    const ByteOffset offset = batch.offsets[index];
+
+                    lineNumber++;
+                    nextOffset = offset + line.size() + 1;
+                    counters.lines++;
+
+                    processLineEvent(input, statistics, batch.events[index], line, offset, lineNumber, counters);
+
+                    if (checkpointer.isDue(lineNumber)) {
+                        checkpointer.write({&statistics}, input, lineNumber, nextOffset);
+                    }
+
+                    instrumentation().dumpIfRequested(counters);
+                }
+
+                isLast = batch.isLast;
+                freeBatches.push(&batch);
+            }
+
+            if (checkpointer.isEnabled()) {
+                checkpointer.write({&statistics}, input, lineNumber, nextOffset);
+            }
+
+            instrumentation().add(counters);
+        }
+
+        InputSource &input;
+        TollStatistics &statistics;
+
+        std::vector<PipelineBatch> batches;
+
+        SpscRing<PipelineBatch *, pipelineBatches> freeBatches;
+        SpscRing<PipelineBatch *, pipelineBatches> readBatches;
+        SpscRing<PipelineBatch *, pipelineBatches> parsedBatches;
+    };
+}
+
+// Serving queries.
+namespace {
+    // Answers queries sent by clients connected to a Unix domain socket, on a
+    // separate thread. Statistics are read holding statisticsMutex, which is
+    // held by processing only for a single line, and answers are sent after
+    // it is released, so slow clients do not hold up processing. Every line
+    // sent to the socket has to be a query.
+    class QueryServer {
+    public:
+        QueryServer(const int listener, TollStatistics &statistics)
+                : listener(listener), statistics(statistics) {}
+
+        QueryServer(const QueryServer &) = delete;
+        QueryServer &operator=(const QueryServer &) = delete;
+
+        ~QueryServer() {
+            if (server.joinable()) {
+                writeAll(stopPipe[1], "", 1);
+                server.join();
+                close(stopPipe[0]);
+                close(stopPipe[1]);
+            }
+
+            for (const auto &connection : connections) {
+                close(connection.descriptor);
+            }
+
+            close(listener);
+        }
+
+        // Starts serving queries. Returns false on failure.
+        bool start() {
+            if (pipe2(stopPipe, O_CLOEXEC) < 0) {
+                return false;
+            }
+
+            server = std::thread([this] { serve(); });
+
+            return true;
+        }
+
+        [[nodiscard]] std::mutex &getStatisticsMutex() {
+            return statisticsMutex;
+        }
+
+    private:
+        void serve() {
+            while (waitForConnections(listener, connections, stopPipe[0])) {
+                if (isStopped()) {
+                    return;
+                }
+
+                for (auto &connection : connections) {
+                    answerQueries(connection);
+                }
+
+                removeClosedConnections(connections);
+            }
+        }
+
+        // Checks whether serving is to be stopped, without waiting.
+        bool isStopped() const {
+            pollfd stopDescriptor{stopPipe[0], POLLIN, 0};
+
+            return poll(&stopDescriptor, 1, 0) > 0;
+        }
+
+        // Answers all queries received on connection. Lines which are not
+        // queries are reported as erroneous, numbered within the connection.
+        void answerQueries(SocketConnection &connection) {
+            std::string answers;
+            std::string_view line;
+
+            {
+                StageCounters counters;
+                OutputWriter output(answers);
+
+                while (connection.takeLine(line)) {
+                    const LineEvent event = parseLine(line);
+
+                    if (isQuery(event)) {
+                        std::lock_guard<std::mutex> statisticsLock(statisticsMutex);
+
+                        processCountedQuery(output, statistics, event, counters);
+                    } else if (event.type != LineEventType::Empty) {
+                        output << "Error in line " << connection.lineNumber << ": " << line;
+                        output.endLine();
+                    }
+                }
+
+                if (instrumented) {
+                    instrumentation().add(counters);
+                }
+            }
+
+            // Answers to a client which has gone away are dropped.
+            size_t sent = 0;
+
+            while (sent < answers.size()) {
+                const ssize_t written = send(connection.descriptor, answers.data() + sent,
+                                             answers.size() - sent, MSG_NOSIGNAL);
+
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+
+                if (written < 0) {
+                    connection.isClosed = true;
+                    connection.position = connection.received.size();
+
+                    break;
+                }
+
+                sent += static_cast<size_t>(written);
+            }
+        }
+
+        const int listener;
+        TollStatistics &statistics;
+        std::mutex statisticsMutex;
+
+        std::thread server;
+        int stopPipe[2] = {-1, -1};
+
+        std::vector<SocketConnection> connections;
+    };
+}
+
+// Running tasks on a fixed group of threads.
+namespace {
+    // Pool of workers executing the same task in parallel. Worker 0 is the calling thread.
+    class WorkerPool {
+    public:
+        explicit WorkerPool(const size_t size) : size(size) {
+            for (size_t worker = 1; worker < size; worker++) {
+                threads.emplace_back([this, worker] { work(worker); });
+            }
+        }
+
+        WorkerPool(const WorkerPool &) = delete;
+        WorkerPool &operator=(const WorkerPool &) = delete;
+
+        ~WorkerPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+
+            taskStarted.notify_all();
+
+            for (auto &thread : threads) {
+                thread.join();
+            }
+        }
+
+        [[nodiscard]] size_t getSize() const {
+            return size;
+        }
+
+        // Runs task(worker) for every worker and waits until all of them finish.
+        void run(const std::function<void(size_t)> &newTask) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                task = &newTask;
+                unfinishedWorkers = size - 1;
+                generation++;
+            }
+
+            taskStarted.notify_all();
+
+            newTask(0);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            taskFinished.wait(lock, [this] { return unfinishedWorkers == 0; });
+        }
+
+    private:
+        void work(const size_t worker) {
+            size_t seenGeneration = 0;
+
+            while (true) {
+                const std::function<void(size_t)> *currentTask;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    taskStarted.wait(lock, [&] { return stopping || generation != seenGeneration; });
+
+                    if (stopping) {
+                        return;
+                    }
+
+                    seenGeneration = generation;
+                    currentTask = task;
+                }
+
+                (*currentTask)(worker);
+
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if (--unfinishedWorkers == 0) {
+                    taskFinished.notify_one();
+                }
+            }
+        }
+
+        const size_t size;
+        std::vector<std::thread> threads;
+
+        std::mutex mutex;
+        std::condition_variable taskStarted;
+        std::condition_variable taskFinished;
+
+        const std::function<void(size_t)> *task = nullptr;
+        size_t generation = 0;
+        size_t unfinishedWorkers = 0;
+        bool stopping = false;
+    };
+}
+
+// Processing line events in parallel, sharded by license plate.
+namespace {
+    // Number of lines read before they are processed together.
+    constexpr size_t parallelBatchSize = 1 << 16;
+
+    // Erroneous line together with number of line that revealed the error.
+    struct ShardError {
+        LineNumber reportLineNumber;
+        ErroneousLine erroneousLine;
+    };
+
+    // Statistics of cars with license plates hashing to a single shard.
+    struct Shard {
+        TollStatistics statistics;
+
+        // Errors found in the currently processed part of a batch.
+        std::vector<ShardError> errors;
+
+        // Batch indexes of entrances which became pending and locations of
+        // paired entrances in the currently processed part of a batch, if
+        // input keeps lines of pending entrances.
+        std::vector<size_t> pendingIndexes;
+        std::vector<LineLocation> pairedLocations;
+    };
+
+    // Returns shard responsible for a car with given license plate.
+    // High bits of the hash are used, as low ones choose slots of LicensePlateMap.
+    inline size_t shardOfLicensePlate(const LicensePlate &licensePlate, const size_t shards) {
+        return (licensePlate.hash() >> 32) % shards;
+    }
+
+    // Processes input in batches. Every worker parses a contiguous part of a batch,
+    // then every worker pairs road entrances of cars from its own shard. Queries
+    // are answered between such phases by merging statistics of all shards, and
+    // errors are reported in the order of lines that revealed them, so output is
+    // identical to sequential processing.
+    class ParallelTollCounter {
+    public:
+        ParallelTollCounter(const size_t threads, InputSource &input)
+                : input(input), workers(threads), shards(threads), routedEntrances(threads),
+                  workerCounters(threads) {
+
+            for (auto &routed : routedEntrances) {
+                routed.resize(threads);
+            }
+        }
+
+        // Returns statistics of shard responsible for a car with given license plate.
+        TollStatistics &statisticsOf(const LicensePlate &licensePlate) {
+            return shards[shardOfLicensePlate(licensePlate, shards.size())].statistics;
+        }
+
+        // Returns statistics of the first shard, e.g. to store restored roads.
+        TollStatistics &firstStatistics() {
+            return shards.front().statistics;
+        }
+
+        // Processes the rest of input, starting at nextOffset after line lineNumber.
+        void process(LineNumber lineNumber, ByteOffset nextOffset, Checkpointer &checkpointer) {
+            const bool copyLines = !input.isPersistent();
+
+            batch.resize(parallelBatchSize);
+            offsets.resize(parallelBatchSize);
+
+            if (copyLines) {
+                copiedBatch.resize(parallelBatchSize);
+            }
+
+            bool endOfInput = false;
+
+            while (!endOfInput) {
+                size_t batchSize = 0;
+
+                while (batchSize < parallelBatchSize
+                       && !(endOfInput = !readTimedLine(input, batch[batchSize], offsets[batchSize], counters))) {
+
+                    if (copyLines) {
+                        copiedBatch[batchSize] = batch[batchSize];
+                        batch[batchSize] = copiedBatch[batchSize];
+                    }
+
+                    batchSize++;
+                }
+
+                processBatch(batchSize, lineNumber + 1);
+
+                lineNumber += batchSize;
+                counters.lines += batchSize;
+
+                if (batchSize > 0) {
+                    nextOffset = offsets[batchSize - 1] + batch[batchSize - 1].size() + 1;
+                }
+
+                if (checkpointer.isDue(lineNumber) || (endOfInput && checkpointer.isEnabled())) {
+                    checkpointer.write(allStatistics(), input, lineNumber, nextOffset);
+                }
+
+                if (instrumented) {
+                    gatherCounters();
+                    instrumentation().dumpIfRequested(counters);
+                }
+            }
+
+            instrumentation().add(counters);
+        }
+
+    private:
+        // Adds counters of workers to counters of the processing thread.
+        void gatherCounters() {
+            size_t unpairedEntrances = 0;
+
+            for (auto &shardCounters : workerCounters) {
+                counters.add(shardCounters);
+                shardCounters = {};
+            }
+
+            for (const auto &shard : shards) {
+                unpairedEntrances += shard.statistics.unpairedCarEntrances.size();
+            }
+
+            counters.noteUnpairedEntrances(unpairedEntrances);
+        }
+
+        [[nodiscard]] std::vector<const TollStatistics *> allStatistics() const {
+            std::vector<const TollStatistics *> statistics;
+
+            for (const auto &shard : shards) {
+                statistics.push_back(&shard.statistics);
+            }
+
+            return statistics;
+        }
+
+        // Processes lines numbered firstLineNumber, firstLineNumber + 1, ... stored in batch.
+        void processBatch(const size_t batchSize, const LineNumber firstLineNumber) {
+            events.resize(batchSize);
+
+            workers.run([&](size_t worker) { parsePart(worker, batchSize); });
+
+            // Indexes of routedEntrances already processed by a shard, per parsing worker.
+            std::vector<std::vector<size_t>> cursors(shards.size(), std::vector<size_t>(shards.size()));
+
+            size_t segmentBegin = 0;
+
+            for (size_t index = 0; index <= batchSize; index++) {
+                const bool isQuery = index < batchSize && ::isQuery(events[index]);
+
+                if (index < batchSize && !isQuery) {
+                    continue;
+                }
+
+                // Pair entrances preceding the query (or the end of batch) in every shard.
+                workers.run([&](size_t shard) {
+                    pairEntrances(shard, cursors[shard], index, firstLineNumber);
+                });
+
+                if (input.keepsLines()) {
+                    updateKeptLines();
+                }
+
+                StageTimer timer(counters, Stage::Output);
+
+                outputErrors(segmentBegin, index, firstLineNumber);
+
+                if (isQuery) {
+                    const Ticks start = timer.elapsed();
+
+                    answerQuery(events[index]);
+
+                    if (instrumented) {
+                        counters.queries++;
+                        instrumentation().addQueryLatency(events[index].type, timer.elapsed() - start);
+                    }
+                }
+
+                segmentBegin = index + 1;
+            }
+        }
+
+        // Parses worker's part of the batch and routes road entrances to shards.
+        void parsePart(const size_t worker, const size_t batchSize) {
+            const size_t partSize = (batchSize + shards.size() - 1) / shards.size();
+            const size_t begin = std::min(batchSize, worker * partSize);
+            const size_t end = std::min(batchSize, begin + partSize);
+
+            for (auto &routed : routedEntrances[worker]) {
+                routed.clear();
+            }
+
+            for (size_t index = begin; index < end; index++) {
+                events[index] = parseTimedLine(batch[index], workerCounters[worker]);
+
+                if (events[index].type == LineEventType::RoadEntrance) {
+                    const size_t shard = shardOfLicensePlate(events[index].licensePlate, shards.size());
+
+                    routedEntrances[worker][shard].push_back(index);
+                }
+            }
+        }
+
+        // Processes road entrances of the shard with batch indexes lower than end.
+        void pairEntrances(const size_t shard, std::vector<size_t> &cursors,
+                           const size_t end, const LineNumber firstLineNumber) {
+
+            auto &[statistics, errors, pendingIndexes, pairedLocations] = shards[shard];
+            const bool keepsLines = input.keepsLines();
+
+            for (size_t worker = 0; worker < routedEntrances.size(); worker++) {
+                const auto &routed = routedEntrances[worker][shard];
+
+                for (; cursors[worker] < routed.size() && routed[cursors[worker]] < end; cursors[worker]++) {
+                    const size_t index = routed[cursors[worker]];
+                    const LineEvent &event = events[index];
+                    const LineNumber lineNumber = firstLineNumber + index;
+
+                    const auto [erroneousLine, pairedLocation] = processCountedRoadEntrance(
+                            statistics, event, {offsets[index], batch[index].size()}, lineNumber,
+                            workerCounters[shard]);
+
+                    if (keepsLines) {
+                        if (pairedLocation) {
+                            pairedLocations.push_back(*pairedLocation);
+                        } else {
+                            pendingIndexes.push_back(index);
+                        }
+                    }
+
+                    if (erroneousLine) {
+                        errors.push_back({lineNumber, *erroneousLine});
+                    }
+                }
+            }
+        }
+
+        // Passes entrances of all shards which became pending or were paired
+        // to input, which keeps lines only on the calling thread.
+        void updateKeptLines() {
+            for (auto &shard : shards) {
+                for (const size_t index : shard.pendingIndexes) {
+                    input.keepLine({offsets[index], batch[index].size()}, batch[index]);
+                }
+
+                for (const auto &location : shard.pairedLocations) {
+                    input.releaseLine(location);
+                }
+
+                shard.pendingIndexes.clear();
+                shard.pairedLocations.clear();
+            }
+        }
+
+        // Outputs errors revealed by lines with batch indexes in range [begin, end).
+        void outputErrors(const size_t begin, const size_t end, const LineNumber firstLineNumber) {
+            std::vector<ShardError> errors;
+
+            for (size_t index = begin; index < end; index++) {
+                if (events[index].type == LineEventType::Erroneous) {
+                    const LineNumber lineNumber = firstLineNumber + index;
+
+                    errors.push_back({lineNumber, {lineNumber, {offsets[index], batch[index].size()}}});
+                }
+            }
+
+            for (auto &shard : shards) {
+                std::move(shard.errors.begin(), shard.errors.end(), std::back_inserter(errors));
+                shard.errors.clear();
+            }
+
+            // Every line reveals at most one error.
+            std::sort(errors.begin(), errors.end(), [](const ShardError &a, const ShardError &b) {
+                return a.reportLineNumber < b.reportLineNumber;
+            });
+
+            for (const auto &[reportLineNumber, erroneousLine] : errors) {
+                // Lines which are erroneous themselves are still in the batch.
+                if (erroneousLine.lineNumber == reportLineNumber) {
+                    outputErroneousLine(batch[reportLineNumber - firstLineNumber], reportLineNumber);
+                } else {
+                    outputErroneousLine(input.lineAt(erroneousLine.location), erroneousLine.lineNumber);
+                    input.releaseLine(erroneousLine.location);
+                }
+            }
+        }
+
+        // Answers query using statistics merged from all shards.
+        void answerQuery(const LineEvent &event) {
+            if (event.type == LineEventType::AllStatisticsQuery) {
+                outputMileagesOfCarsByRoadCategories();
+                outputMileagesOfRoads(answerOutput(), mergedMileagesOfRoads());
+
+                return;
+            }
+
+            if (event.type == LineEventType::TopQuery) {
+                // Rankings are built by the first top query.
+                if (shards.front().statistics.rankings.getCapacity() < event.topCount) {
+                    workers.run([&](size_t shard) { rankAllMileages(shards[shard].statistics, event.topCount); });
+                }
+
+                answerTopQuery(event.topCount, event.topRoadCategory);
+
+                return;
+            }
+
+            if (event.isCarQuery) {
+                const size_t shard = shardOfLicensePlate(event.licensePlate, shards.size());
+
+                processCarMileageQuery(answerOutput(), shards[shard].statistics.mileagesOfCarsByRoadCategories,
+                                       event.licensePlate);
+            }
+
+            if (event.isRoadQuery) {
+                processRoadMileageQuery(answerOutput(), mergedMileagesOfRoads(), event.road);
+            }
+        }
+
+        // Answers top query merging rankings of cars from all shards. Shards
+        // rank only their partial sums of road mileages, so roads are ranked
+        // from merged statistics.
+        void answerTopQuery(const size_t count, const RoadCategory roadCategory) const {
+            std::vector<const MileageRanking<LicensePlate> *> carsRankings;
+
+            for (const auto &shard : shards) {
+                carsRankings.push_back(&shard.statistics.rankings.carsRanking(roadCategory));
+            }
+
+            MileageRankings mergedRankings;
+            mergedRankings.reset(count);
+
+            for (const auto &[road, mileage] : mergedMileagesOfRoads()) {
+                mergedRankings.roadsByRoadCategory[roadCategoryToIndex(road.second)].update(road, std::nullopt,
+                                                                                             mileage);
+            }
+
+            outputTopMileages(answerOutput(), carsRankings,
+                              [this](const LicensePlate &licensePlate) -> const MileageByRoadCategory & {
+                                  const size_t shard = shardOfLicensePlate(licensePlate, shards.size());
+
+                                  return *shards[shard].statistics.mileagesOfCarsByRoadCategories.find(licensePlate);
+                              },
+                              mergedRankings.roadsRankings(roadCategory), count);
+        }
+
+        // Outputs mileages of all cars, merging sorted statistics of shards.
+        void outputMileagesOfCarsByRoadCategories() const {
+            using Entries = std::vector<const CarStatistics::Entry *>;
+            using Iterator = Entries::const_iterator;
+            using Range = std::pair<Iterator, Iterator>;
+
+            auto greaterLicensePlate = [](const Range &a, const Range &b) {
+                return (*b.first)->first < (*a.first)->first;
+            };
+
+            std::vector<Entries> sortedEntriesOfShards;
+            sortedEntriesOfShards.reserve(shards.size());
+
+            std::priority_queue<Range, std::vector<Range>, decltype(greaterLicensePlate)> ranges(greaterLicensePlate);
+
+            for (const auto &shard : shards) {
+                const auto &sortedEntries = sortedEntriesOfShards.emplace_back(
+                        shard.statistics.mileagesOfCarsByRoadCategories.sortedEntries());
+
+                if (!sortedEntries.empty()) {
+                    ranges.emplace(sortedEntries.begin(), sortedEntries.end());
+                }
+            }
+
+            while (!ranges.empty()) {
+                auto [iterator, end] = ranges.top();
+                ranges.pop();
+
+                outputCarMileageByRoadCategories(answerOutput(), (*iterator)->second, (*iterator)->first);
+
+                if (++iterator != end) {
+                    ranges.emplace(iterator, end);
+                }
+            }
+        }
+
+        // Sums partial mileages of roads from all shards.
+        [[nodiscard]] RoadStatistics mergedMileagesOfRoads() const {
+            RoadStatistics mileagesOfRoads;
+
+            for (const auto &shard : shards) {
+                mileagesOfRoads.merge(shard.statistics.mileagesOfRoads);
+            }
+
+            return mileagesOfRoads;
+        }
+
+        InputSource &input;
+
+        WorkerPool workers;
+        std::vector<Shard> shards;
+
+        // Current batch of lines, their offsets and events recognised in them.
+        std::vector<std::string_view> batch;
+        std::vector<ByteOffset> offsets;
+        std::vector<LineEvent> events;
+
+        // Copies of lines of the current batch if input is not persistent.
+        std::vector<Line> copiedBatch;
+
+        // Map (parsing worker, shard) -> batch indexes of road entrances, in increasing order.
+        std::vector<std::vector<std::vector<size_t>>> routedEntrances;
+
+        // Counters of the processing thread and of every worker.
+        StageCounters counters;
+        std::vector<StageCounters> workerCounters;
+    };
+}
+
+// Command line options.
+namespace {
+    struct Options {
+        // Number of threads processing input, 1 means sequential processing.
+        size_t threads = 1;
+
+        // Sequential processing is split into reading, parsing and updating
+        // statistics, running on separate threads.
+        bool isPipelined = false;
+
+        // File mapped into memory and read instead of standard input.
+        const char *inputPath = nullptr;
+
+        // Checkpoint written every checkpointInterval lines (if it is not 0),
+        // after the line being processed when SIGUSR1 arrives and at the end of input.
+        const char *checkpointPath = nullptr;
+        LineNumber checkpointInterval = 0;
+
+        // Checkpoint restored at startup.
+        const char *restorePath = nullptr;
+
+        // Input file is followed as it is appended to, instead of being mapped.
+        bool isFollowing = false;
+
+        // Input file or standard input is gzip compressed.
+        bool isCompressed = false;
+
+        // Unix domain socket on which lines are received instead of standard input.
+        const char *listenPath = nullptr;
+
+        // Unix domain socket on which queries are answered during processing.
+        const char *queryPath = nullptr;
+
+        // File to which instrumentation is dumped at the end and on SIGUSR2.
+        const char *instrumentationPath = nullptr;
+    };
+
+    // Outputs program usage.
+    void outputUsage(const char *programName) {
+        std::cerr << "Usage: " << programName << " [-j THREADS | --pipeline] [--checkpoint FILE [--checkpoint-every LINES]]"
+                  << " [--restore FILE] [--query-socket SOCKET]"
+                  << (instrumented ? " [--stats FILE]" : "")
+                  << " [--follow FILE | --listen SOCKET | [--gzip] [FILE]]" << std::endl;
+    }
+
+    // Parses positive number with at most maxDigits digits. Returns false if it is invalid.
+    bool parseNumberOption(const std::string_view value, const size_t maxDigits, size_t &number) {
+        if (value.empty() || value.size() > maxDigits || skipDigits(value, 0) != value.size()) {
+            return false;
+        }
+
+        number = std::stoull(std::string(value));
+
+        return number > 0;
+    }
+
+    // Parses command line options. Returns false if they are invalid.
+    bool parseOptions(const int argc, char *argv[], Options &options) {
+        for (int i = 1; i < argc; i++) {
+            const std::string_view option = argv[i];
+
+            if (option == "-j" && i + 1 < argc) {
+                if (!parseNumberOption(argv[++i], 4, options.threads)) {
+                    return false;
+                }
+            } else if (option == "--pipeline") {
+                options.isPipelined = true;
+            } else if (option == "--checkpoint" && i + 1 < argc) {
+                options.checkpointPath = argv[++i];
+            } else if (option == "--checkpoint-every" && i + 1 < argc) {
+                if (!parseNumberOption(argv[++i], 18, options.checkpointInterval)) {
+                    return false;
+                }
+            } else if (option == "--restore" && i + 1 < argc) {
+                options.restorePath = argv[++i];
+            } else if (option == "--follow") {
+                options.isFollowing = true;
+            } else if (option == "--gzip") {
+                options.isCompressed = true;
+            } else if (option == "--listen" && i + 1 < argc) {
+                options.listenPath = argv[++i];
+            } else if (option == "--query-socket" && i + 1 < argc) {
+                options.queryPath = argv[++i];
+            } else if (instrumented && option == "--stats" && i + 1 < argc) {
+                options.instrumentationPath = argv[++i];
+            } else if (!option.empty() && option[0] != '-' && options.inputPath == nullptr) {
+                options.inputPath = argv[i];
+            } else {
+                return false;
+            }
+        }
+
+        // Following and serving queries require sequential processing,
+        // which does not wait for whole batches of lines, unlike parallel
+        // and pipelined processing.
+        const bool isServing = options.isFollowing || options.listenPath != nullptr
+                               || options.queryPath != nullptr;
+
+        return (options.checkpointPath != nullptr || options.checkpointInterval == 0)
+               && (!options.isFollowing || options.inputPath != nullptr)
+               && (options.listenPath == nullptr || options.inputPath == nullptr)
+               && (!options.isCompressed || (!options.isFollowing && options.listenPath == nullptr))
+               && (!isServing || (options.threads == 1 && !options.isPipelined))
+               && (!options.isPipelined || options.threads == 1);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+
+    if (!parseOptions(argc, argv, options)) {
+        outputUsage(argv[0]);
+
+        return 1;
+    }
+
+    std::unique_ptr<InputSource> input;
+
+    if (options.listenPath != nullptr) {
+        input = openSocketInput(options.listenPath);
+
+        if (input == nullptr) {
+            std::cerr << "Cannot listen on " << options.listenPath << std::endl;
+
+            return 1;
+        }
+    } else if (options.isCompressed) {
+        input = openDecompressedInput(options.inputPath);
+
+        if (input == nullptr) {
+            std::cerr << "Cannot read " << (options.inputPath != nullptr ? options.inputPath : "standard input")
+                      << std::endl;
+
+            return 1;
+        }
+    } else if (options.inputPath != nullptr) {
+        input = options.isFollowing ? openFollowedInput(options.inputPath) : openMappedInput(options.inputPath);
+
+        if (input == nullptr) {
+            std::cerr << "Cannot read " << options.inputPath << std::endl;
+
+            return 1;
+        }
+    } else {
+        input = openStandardInput();
+    }
+
+    std::unique_ptr<CheckpointFile> restoredCheckpoint;
+    LineNumber lineNumber = 0;
+    ByteOffset nextOffset = 0;
+
+    if (options.restorePath != nullptr) {
+        restoredCheckpoint = openCheckpoint(options.restorePath);
+
+        if (restoredCheckpoint == nullptr) {
+            std::cerr << "Cannot restore checkpoint " << options.restorePath << std::endl;
+
+            return 1;
+        }
+
+        lineNumber = restoredCheckpoint->getLineNumber();
+        input->setRestoredLines(restoredCheckpoint->lines());
+
+        if (options.inputPath != nullptr) {
+            nextOffset = restoredCheckpoint->getNextOffset();
+            input->resumeAt(nextOffset);
+        }
+    }
+
+    if (options.checkpointPath != nullptr) {
+        struct sigaction action{};
+        action.sa_handler = requestCheckpoint;
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &action, nullptr);
+    }
+
+    if (options.instrumentationPath != nullptr) {
+        if (!instrumentation().setDumpPath(options.instrumentationPath)) {
+            std::cerr << "Cannot write " << options.instrumentationPath << std::endl;
+
+            return 1;
+        }
+
+        struct sigaction action{};
+        action.sa_handler = requestInstrumentationDump;
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR2, &action, nullptr);
+    }
+
+    Checkpointer checkpointer(options.checkpointPath, options.checkpointInterval, lineNumber);
+
+    setUpOutput(options.isFollowing || options.listenPath != nullptr);
+
+    if (options.threads == 1) {
+        TollStatistics statistics;
+
+        if (restoredCheckpoint != nullptr && !restoredCheckpoint->restore(
+                statistics, [&statistics](const LicensePlate &) -> TollStatistics & { return statistics; })) {
+
+            std::cerr << "Cannot restore checkpoint " << options.restorePath << std::endl;
+
+            return 1;
+        }
+
+        std::unique_ptr<QueryServer> queryServer;
+
+        if (options.queryPath != nullptr) {
+            const int listener = listenOnSocket(options.queryPath);
+
+            if (listener >= 0) {
+                queryServer = std::make_unique<QueryServer>(listener, statistics);
+            }
+
+            if (queryServer == nullptr || !queryServer->start()) {
+                std::cerr << "Cannot listen on " << options.queryPath << std::endl;
+
+                return 1;
+            }
+        }
+
+        if (options.isPipelined) {
+            PipelinedTollCounter(*input, statistics).process(lineNumber, nextOffset, checkpointer);
+        } else {
+            processSequentially(*input, statistics, lineNumber, nextOffset, checkpointer,
+                                queryServer == nullptr ? nullptr : &queryServer->getStatisticsMutex());
+        }
+    } else {
+        ParallelTollCounter counter(options.threads, *input);
+
+        if (restoredCheckpoint != nullptr && !restoredCheckpoint->restore(
+                counter.firstStatistics(),
+                [&counter](const LicensePlate &licensePlate) -> TollStatistics & {
+                    return counter.statisticsOf(licensePlate);
+                })) {
+
+            std::cerr << "Cannot restore checkpoint " << options.restorePath << std::endl;
+
+            return 1;
+        }
+
+        counter.process(lineNumber, nextOffset, checkpointer);
+    }
+
+    flushOutput();
+    instrumentation().dump();
+
+    if (input->hasFailed()) {
+        std::cerr << "Cannot decompress input" << std::endl;
+
+        return 1;
     }
 }
\ No newline at end of file
@@ -0,0 +1,362 @@
+// Benchmark driver for nod. Runs the binary several times with a gate log
+// on standard input and reports throughput and peak resident set size.
+// Output of every run is checked to have the same checksum, which can also
+// be compared with an expected one or with output of a baseline binary.
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+#include <cstdint>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Command line options.
+namespace {
+    struct Options {
+        size_t runs = 5;
+
+        // Expected checksum of output, in the form printed by the benchmark.
+        const char *expectedChecksum = nullptr;
+
+        // Binary run with the same arguments, whose output is expected.
+        const char *baselinePath = nullptr;
+
+        const char *logPath = nullptr;
+
+        // Benchmarked binary followed by its arguments, terminated by nullptr.
+        std::vector<char *> command;
+    };
+
+    // Outputs program usage.
+    void outputUsage(const char *programName) {
+        std::cerr << "Usage: " << programName << " [--runs N] [--expect CHECKSUM] [--baseline BINARY]"
+                  << " LOG BINARY [ARGUMENTS...]" << std::endl;
+    }
+
+    // Parses command line options. Returns false if they are invalid.
+    bool parseOptions(const int argc, char *argv[], Options &options) {
+        int i = 1;
+
+        for (; i < argc && argv[i][0] == '-'; i += 2) {
+            const std::string_view option = argv[i];
+
+            if (i + 1 == argc) {
+                return false;
+            }
+
+            if (option == "--runs") {
+                const std::string_view value = argv[i + 1];
+                const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), options.runs);
+
+                if (error != std::errc() || end != value.data() + value.size() || options.runs == 0) {
+                    return false;
+                }
+            } else if (option == "--expect") {
+                options.expectedChecksum = argv[i + 1];
+            } else if (option == "--baseline") {
+                options.baselinePath = argv[i + 1];
+            } else {
+                return false;
+            }
+        }
+
+        if (argc - i < 2) {
+            return false;
+        }
+
+        options.logPath = argv[i++];
+        options.command.assign(argv + i, argv + argc);
+        options.command.push_back(nullptr);
+
+        return true;
+    }
+}
+
+// Running the benchmarked binary.
+namespace {
+    // 64-bit FNV-1a hash of a stream of bytes.
+    class Checksum {
+    public:
+        void add(const char *data, const size_t size) {
+            for (size_t i = 0; i < size; i++) {
+                hash = (hash ^ static_cast<unsigned char>(data[i])) * prime;
+            }
+        }
+
+        [[nodiscard]] uint64_t value() const {
+            return hash;
+        }
+
+    private:
+        static constexpr uint64_t prime = 0x100000001b3;
+
+        uint64_t hash = 0xcbf29ce484222325;
+    };
+
+    struct RunResult {
+        double seconds;
+
+        // Peak resident set size in kilobytes.
+        long peakResidentSize;
+
+        // Checksums of standard output and standard error, as text.
+        std::string checksum;
+    };
+
+    // Formats checksums of standard output and standard error.
+    std::string formatChecksum(const Checksum &answers, const Checksum &errors) {
+        std::ostringstream checksum;
+
+        checksum << std::hex << std::setfill('0') << std::setw(16) << answers.value()
+                 << '-' << std::setw(16) << errors.value();
+
+        return checksum.str();
+    }
+
+    // Reads both outputs of the child until they are closed.
+    bool readOutputs(const int answersDescriptor, const int errorsDescriptor,
+                     Checksum &answers, Checksum &errors) {
+
+        std::vector<char> block(1 << 16);
+        pollfd descriptors[] = {{answersDescriptor, POLLIN, 0}, {errorsDescriptor, POLLIN, 0}};
+        Checksum *checksums[] = {&answers, &errors};
+        size_t open = 2;
+
+        while (open > 0) {
+            if (poll(descriptors, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return false;
+            }
+
+            for (size_t i = 0; i < 2; i++) {
+                if (descriptors[i].fd < 0 || descriptors[i].revents == 0) {
+                    continue;
+                }
+
+                const ssize_t bytesRead = read(descriptors[i].fd, block.data(), block.size());
+
+                if (bytesRead < 0 && errno == EINTR) {
+                    continue;
+                }
+
+                if (bytesRead <= 0) {
+                    close(descriptors[i].fd);
+                    descriptors[i].fd = -1;
+                    open--;
+                } else {
+                    checksums[i]->add(block.data(), static_cast<size_t>(bytesRead));
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // Runs command with log on standard input. Returns nothing if it could
+    // not be run or it did not exit successfully.
+    std::optional<RunResult> runOnce(const std::vector<char *> &command, const char *logPath) {
+        int answersPipe[2], errorsPipe[2];
+
+        if (pipe(answersPipe) < 0 || pipe(errorsPipe) < 0) {
+            return std::nullopt;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const pid_t child = fork();
+
+        if (child == 0) {
+            const int log = open(logPath, O_RDONLY);
+
+            if (log < 0 || dup2(log, STDIN_FILENO) < 0
+                || dup2(answersPipe[1], STDOUT_FILENO) < 0 || dup2(errorsPipe[1], STDERR_FILENO) < 0) {
+
+                _exit(127);
+            }
+
+            close(answersPipe[0]);
+            close(errorsPipe[0]);
+            execv(command[0], command.data());
+            _exit(127);
+        }
+
+        close(answersPipe[1]);
+        close(errorsPipe[1]);
+
+        if (child < 0) {
+            close(answersPipe[0]);
+            close(errorsPipe[0]);
+
+            return std::nullopt;
+        }
+
+        Checksum answers, errors;
+        const bool isRead = readOutputs(answersPipe[0], errorsPipe[0], answers, errors);
+
+        int status;
+        rusage usage{};
+
+        while (wait4(child, &status, 0, &usage) < 0) {
+            if (errno != EINTR) {
+                return std::nullopt;
+            }
+        }
+
+        const auto end = std::chrono::steady_clock::now();
+
+        if (!isRead || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            return std::nullopt;
+        }
+
+        return RunResult{std::chrono::duration<double>(end - start).count(), usage.ru_maxrss,
+                         formatChecksum(answers, errors)};
+    }
+
+    // Counts lines and bytes of the log. Returns false if it cannot be read.
+    bool measureLog(const char *logPath, uint64_t &lines, uint64_t &bytes) {
+        const int log = open(logPath, O_RDONLY);
+
+        if (log < 0) {
+            return false;
+        }
+
+        std::vector<char> block(1 << 16);
+        ssize_t bytesRead;
+        lines = bytes = 0;
+
+        while ((bytesRead = read(log, block.data(), block.size())) > 0) {
+            lines += std::count(block.data(), block.data() + bytesRead, '\n');
+            bytes += static_cast<uint64_t>(bytesRead);
+        }
+
+        close(log);
+
+        return bytesRead == 0;
+    }
+}
+
+// Reporting results.
+namespace {
+    struct Summary {
+        double medianSeconds;
+        double minSeconds;
+        long peakResidentSize;
+        std::string checksum;
+    };
+
+    // Runs command given number of times and outputs a summary of runs.
+    // Returns nothing if any run failed or produced a different output.
+    std::optional<Summary> benchmark(const std::string_view name, const std::vector<char *> &command,
+                                     const char *logPath, const size_t runs,
+                                     const uint64_t lines, const uint64_t bytes) {
+
+        std::vector<double> seconds;
+        Summary summary{0, 0, 0, ""};
+
+        for (size_t run = 0; run < runs; run++) {
+            const auto result = runOnce(command, logPath);
+
+            if (!result) {
+                std::cerr << name << ": run " << run + 1 << " failed" << std::endl;
+
+                return std::nullopt;
+            }
+
+            if (run > 0 && result->checksum != summary.checksum) {
+                std::cerr << name << ": run " << run + 1 << " has checksum " << result->checksum
+                          << " instead of " << summary.checksum << std::endl;
+
+                return std::nullopt;
+            }
+
+            seconds.push_back(result->seconds);
+            summary.checksum = result->checksum;
+            summary.peakResidentSize = std::max(summary.peakResidentSize, result->peakResidentSize);
+        }
+
+        std::sort(seconds.begin(), seconds.end());
+
+        summary.medianSeconds = seconds[seconds.size() / 2];
+        summary.minSeconds = seconds.front();
+
+        std::cout << std::fixed << std::setprecision(3)
+                  << name << ": median " << summary.medianSeconds << " s, min " << summary.minSeconds << " s, "
+                  << std::setprecision(0) << lines / summary.medianSeconds << " lines/s, "
+                  << std::setprecision(1) << bytes / summary.medianSeconds / (1 << 20) << " MiB/s, "
+                  << "peak RSS " << summary.peakResidentSize / 1024.0 << " MiB, "
+                  << "checksum " << summary.checksum << std::endl;
+
+        return summary;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+
+    if (!parseOptions(argc, argv, options)) {
+        outputUsage(argv[0]);
+
+        return 1;
+    }
+
+    uint64_t lines, bytes;
+
+    if (!measureLog(options.logPath, lines, bytes)) {
+        std::cerr << "Cannot read " << options.logPath << std::endl;
+
+        return 1;
+    }
+
+    std::cout << options.logPath << ": " << lines << " lines, " << bytes << " bytes, "
+              << options.runs << " runs" << std::endl;
+
+    const auto summary = benchmark(options.command[0], options.command, options.logPath, options.runs,
+                                   lines, bytes);
+
+    if (!summary) {
+        return 1;
+    }
+
+    if (options.expectedChecksum != nullptr && summary->checksum != options.expectedChecksum) {
+        std::cerr << "Checksum " << summary->checksum << " differs from expected "
+                  << options.expectedChecksum << std::endl;
+
+        return 1;
+    }
+
+    if (options.baselinePath != nullptr) {
+        std::vector<char *> baselineCommand = options.command;
+        baselineCommand[0] = const_cast<char *>(options.baselinePath);
+
+        const auto baseline = benchmark(options.baselinePath, baselineCommand, options.logPath, options.runs,
+                                        lines, bytes);
+
+        if (!baseline) {
+            return 1;
+        }
+
+        std::cout << std::setprecision(2) << "speedup " << baseline->medianSeconds / summary->medianSeconds
+                  << std::endl;
+
+        if (summary->checksum != baseline->checksum) {
+            std::cerr << "Checksum " << summary->checksum << " differs from baseline "
+                      << baseline->checksum << std::endl;
+
+            return 1;
+        }
+    }
+}
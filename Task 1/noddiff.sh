@@ -0,0 +1,101 @@
+#!/bin/sh
+# Differential test of the nod line parser against the last revision of nod
+# which matched lines with std::regex. Both are built from source and run on
+# logs generated by nodgen, and on the same logs with randomly mutated lines,
+# and their standard output and standard error have to be equal byte for byte.
+#
+# Usage: noddiff.sh [SEEDS [LINES [NOD_ARGUMENTS...]]]
+#
+# NOD_ARGUMENTS are passed to the current nod only, e.g. -j 4. The reference
+# revision can be changed with REFERENCE, the compiler with CXX.
+
+set -eu
+
+seeds=${1:-20}
+lines=${2:-5000}
+[ $# -gt 2 ] && shift 2 || set --
+
+directory=$(cd "$(dirname "$0")" && pwd)
+reference=${REFERENCE:-fc618b5d77f467a7477602d1ce59189116902dfb}
+compiler=${CXX:-g++}
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+git -C "$directory" show "$reference:./nod.cc" > "$work/nod_regex.cc"
+
+"$compiler" -std=c++17 -O2 -o "$work/nod_regex" "$work/nod_regex.cc"
+"$compiler" -std=c++17 -O2 -pthread -o "$work/nod" "$directory/nod.cc" -lz
+"$compiler" -std=c++17 -O2 -o "$work/nodgen" "$directory/nodgen.cc"
+
+# Mutates half of the lines by replacing, deleting or inserting a character
+# which is significant for the grammar, or by surrounding them with
+# whitespace. Logs with an even seed do not end with a newline.
+mutate() {
+    LC_ALL=C awk -v seed="$1" '
+        BEGIN {
+            srand(seed)
+            count = split(" |\t|\v|\f|\r|?|,|.|0|1|9|A|S|z|_|-", characters, "|")
+        }
+
+        function mutated(line,    position, character, kind) {
+            if (rand() < 0.5) {
+                return line
+            }
+
+            position = int(rand() * (length(line) + 1)) + 1
+            character = characters[int(rand() * count) + 1]
+            kind = int(rand() * 4)
+
+            if (kind == 0) {
+                return substr(line, 1, position - 1) character substr(line, position + 1)
+            } else if (kind == 1) {
+                return substr(line, 1, position - 1) substr(line, position + 1)
+            } else if (kind == 2) {
+                return substr(line, 1, position - 1) character substr(line, position)
+            } else {
+                return characters[int(rand() * 5) + 1] line characters[int(rand() * 5) + 1]
+            }
+        }
+
+        NR > 1 { print previous }
+        { previous = mutated($0) }
+
+        END {
+            printf "%s", previous
+            if (seed % 2 == 1) {
+                printf "\n"
+            }
+        }'
+}
+
+# Runs both binaries on log, passing the remaining arguments to the current
+# one, and compares their outputs.
+compare() {
+    log=$1
+    shift
+
+    "$work/nod_regex" < "$log" > "$work/expected.out" 2> "$work/expected.err"
+    "$work/nod" "$@" < "$log" > "$work/actual.out" 2> "$work/actual.err"
+
+    if ! cmp -s "$work/expected.out" "$work/actual.out" || ! cmp -s "$work/expected.err" "$work/actual.err"; then
+        cp "$log" noddiff.log
+        echo "Output differs on log saved as noddiff.log" >&2
+        exit 1
+    fi
+}
+
+seed=1
+
+while [ "$seed" -le "$seeds" ]; do
+    "$work/nodgen" --lines "$lines" --cars 50 --roads 10 --queries 0.2 --errors 0.05 \
+                   --interleaving 20 --seed "$seed" > "$work/generated.log"
+    mutate "$seed" < "$work/generated.log" > "$work/mutated.log"
+
+    compare "$work/generated.log" "$@"
+    compare "$work/mutated.log" "$@"
+
+    seed=$((seed + 1))
+done
+
+echo "Outputs are equal on $seeds generated and $seeds mutated logs of $lines lines"
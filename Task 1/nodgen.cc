@@ -0,0 +1,339 @@
+// Generator of synthetic gate logs for nod, written to standard output.
+// The same options and seed always produce the same log, as only the raw
+// output of mt19937_64 is used, which is fully specified by the standard.
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_set>
+#include <random>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+
+// Workload parameters.
+namespace {
+    struct Workload {
+        // Number of generated lines.
+        uint64_t lines = 1000000;
+
+        // Number of distinct cars and roads.
+        uint64_t cars = 100000;
+        uint64_t roads = 200;
+
+        // Fraction of roads which are expressways (S), the rest are motorways (A).
+        double expresswayRatio = 0.3;
+
+        // Fractions of lines which are queries and which are erroneous.
+        double queryRatio = 0.01;
+        double errorRate = 0.001;
+
+        // Fraction of queries which are top queries. The original nod reports
+        // them as erroneous lines, so they are not generated by default.
+        double topQueryRatio = 0;
+
+        // Number of cars driving on roads at the same time, so their
+        // entrances and exits interleave.
+        uint64_t interleaving = 1000;
+
+        uint64_t seed = 1;
+    };
+
+    // Outputs program usage.
+    void outputUsage(const char *programName) {
+        std::cerr << "Usage: " << programName << " [--lines N] [--cars N] [--roads N] [--expressways RATIO]"
+                  << " [--queries RATIO] [--top-queries RATIO] [--errors RATIO] [--interleaving N] [--seed N]"
+                  << std::endl;
+    }
+
+    bool parseNumber(const std::string_view value, uint64_t &number) {
+        const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), number);
+
+        return error == std::errc() && end == value.data() + value.size();
+    }
+
+    bool parseRatio(const std::string_view value, double &ratio) {
+        try {
+            size_t parsed;
+            ratio = std::stod(std::string(value), &parsed);
+
+            return parsed == value.size() && ratio >= 0 && ratio <= 1;
+        } catch (const std::exception &) {
+            return false;
+        }
+    }
+
+    // Parses command line options. Returns false if they are invalid.
+    bool parseOptions(const int argc, char *argv[], Workload &workload) {
+        for (int i = 1; i < argc; i++) {
+            const std::string_view option = argv[i];
+
+            if (i + 1 == argc) {
+                return false;
+            }
+
+            const std::string_view value = argv[++i];
+            bool isValid;
+
+            if (option == "--lines") {
+                isValid = parseNumber(value, workload.lines);
+            } else if (option == "--cars") {
+                isValid = parseNumber(value, workload.cars) && workload.cars > 0;
+            } else if (option == "--roads") {
+                isValid = parseNumber(value, workload.roads) && workload.roads > 0 && workload.roads <= 1998;
+            } else if (option == "--expressways") {
+                isValid = parseRatio(value, workload.expresswayRatio);
+            } else if (option == "--queries") {
+                isValid = parseRatio(value, workload.queryRatio);
+            } else if (option == "--top-queries") {
+                isValid = parseRatio(value, workload.topQueryRatio);
+            } else if (option == "--errors") {
+                isValid = parseRatio(value, workload.errorRate);
+            } else if (option == "--interleaving") {
+                isValid = parseNumber(value, workload.interleaving) && workload.interleaving > 0;
+            } else if (option == "--seed") {
+                isValid = parseNumber(value, workload.seed);
+            } else {
+                isValid = false;
+            }
+
+            if (!isValid) {
+                return false;
+            }
+        }
+
+        return workload.interleaving <= workload.cars;
+    }
+}
+
+// Generating lines.
+namespace {
+    using Mileage = uint64_t;
+
+    // Car driving on a road since its entrance.
+    struct Drive {
+        size_t car;
+        size_t road;
+        Mileage mileage;
+    };
+
+    class LogGenerator {
+    public:
+        explicit LogGenerator(const Workload &workload) : workload(workload), random(workload.seed) {
+            generateLicensePlates();
+            generateRoads();
+
+            isDriving.resize(licensePlates.size());
+        }
+
+        void generate() {
+            for (uint64_t line = 0; line < workload.lines; line++) {
+                if (chance(workload.queryRatio)) {
+                    generateQuery();
+                } else if (chance(workload.errorRate)) {
+                    generateError();
+                } else {
+                    generateEntrance();
+                }
+            }
+
+            flush();
+        }
+
+    private:
+        static constexpr std::string_view alphanumerics =
+                "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+        static constexpr size_t bufferSize = 1 << 16;
+
+        // License plates look like real ones, mostly upper case letters and digits.
+        void generateLicensePlates() {
+            std::unordered_set<std::string> generated;
+
+            while (licensePlates.size() < workload.cars) {
+                std::string licensePlate(uniform(5, 8), ' ');
+
+                for (auto &character : licensePlate) {
+                    character = alphanumerics[uniform(0, alphanumerics.size() - 1)];
+                }
+
+                if (generated.insert(licensePlate).second) {
+                    licensePlates.push_back(std::move(licensePlate));
+                }
+            }
+        }
+
+        // Roads have distinct numbers within each category.
+        void generateRoads() {
+            std::vector<std::string> numbers;
+
+            for (unsigned number = 1; number <= 999; number++) {
+                numbers.push_back(std::to_string(number));
+            }
+
+            // At most 999 roads of each category.
+            const uint64_t expressways = std::clamp(static_cast<uint64_t>(workload.roads * workload.expresswayRatio
+                                                                          + 0.5),
+                                                    std::max<uint64_t>(workload.roads, 999) - 999,
+                                                    std::min<uint64_t>(workload.roads, 999));
+
+            shuffle(numbers);
+
+            for (size_t i = 0; i < expressways; i++) {
+                roads.push_back('S' + numbers[i]);
+            }
+
+            shuffle(numbers);
+
+            for (size_t i = 0; i < workload.roads - expressways; i++) {
+                roads.push_back('A' + numbers[i]);
+            }
+        }
+
+        // Starts a drive of a car which is not driving, or ends a random drive.
+        void generateEntrance() {
+            if (drives.size() < workload.interleaving && (drives.empty() || chance(0.5))) {
+                size_t car;
+
+                do {
+                    car = uniform(0, licensePlates.size() - 1);
+                } while (isDriving[car]);
+
+                const Drive drive{car, uniform(0, roads.size() - 1), uniform(0, 9999999)};
+
+                isDriving[car] = true;
+                drives.push_back(drive);
+                outputEntrance(drive.car, drive.road, drive.mileage);
+            } else {
+                const size_t index = uniform(0, drives.size() - 1);
+                const Drive drive = drives[index];
+                const Mileage distance = uniform(1, 5000);
+                const Mileage mileage = drive.mileage >= distance && chance(0.5) ? drive.mileage - distance
+                                                                                 : drive.mileage + distance;
+
+                drives[index] = drives.back();
+                drives.pop_back();
+                isDriving[drive.car] = false;
+                outputEntrance(drive.car, drive.road, mileage);
+            }
+        }
+
+        // Outputs either an entrance of a driving car on another road, which
+        // makes its previous entrance erroneous, or a malformed line.
+        void generateError() {
+            if (!drives.empty() && roads.size() > 1 && chance(0.5)) {
+                const size_t index = uniform(0, drives.size() - 1);
+                Drive &drive = drives[index];
+
+                drive.road = (drive.road + uniform(1, roads.size() - 1)) % roads.size();
+                drive.mileage = uniform(0, 9999999);
+                outputEntrance(drive.car, drive.road, drive.mileage);
+
+                return;
+            }
+
+            const std::string &licensePlate = licensePlates[uniform(0, licensePlates.size() - 1)];
+            const std::string &road = roads[uniform(0, roads.size() - 1)];
+
+            switch (uniform(0, 3)) {
+                case 0:
+                    // Mileage without decimal part.
+                    output(licensePlate + ' ' + road + ' ' + std::to_string(uniform(0, 999999)));
+                    break;
+                case 1:
+                    // Road number with a leading zero.
+                    output(licensePlate + ' ' + road.front() + '0' + road.substr(1) + " 1,0");
+                    break;
+                case 2:
+                    // License plate too short.
+                    output(licensePlate.substr(0, 2) + ' ' + road + " 1,0");
+                    break;
+                default:
+                    output("? " + licensePlate + ' ' + road + " 1,0");
+                    break;
+            }
+        }
+
+        // Outputs query about a car, a road, top mileages or all statistics.
+        void generateQuery() {
+            if (chance(workload.topQueryRatio)) {
+                output("? TOP " + std::to_string(uniform(1, 20)));
+
+                return;
+            }
+
+            const uint64_t kind = uniform(0, 90);
+
+            if (kind < 45) {
+                output("? " + licensePlates[uniform(0, licensePlates.size() - 1)]);
+            } else if (kind < 90) {
+                output("? " + roads[uniform(0, roads.size() - 1)]);
+            } else {
+                output("?");
+            }
+        }
+
+        void outputEntrance(const size_t car, const size_t road, const Mileage mileage) {
+            output(licensePlates[car] + ' ' + roads[road] + ' '
+                   + std::to_string(mileage / 10) + ',' + static_cast<char>('0' + mileage % 10));
+        }
+
+        void output(const std::string &line) {
+            if (buffer.size() + line.size() + 1 > bufferSize) {
+                flush();
+            }
+
+            buffer += line;
+            buffer += '\n';
+        }
+
+        void flush() {
+            std::cout.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        }
+
+        bool chance(const double probability) {
+            return static_cast<double>(random() >> 11) * 0x1.0p-53 < probability;
+        }
+
+        // Returns number from [min, max], with negligible bias for ranges used here.
+        uint64_t uniform(const uint64_t min, const uint64_t max) {
+            return min + random() % (max - min + 1);
+        }
+
+        void shuffle(std::vector<std::string> &elements) {
+            for (size_t i = elements.size(); i > 1; i--) {
+                std::swap(elements[i - 1], elements[uniform(0, i - 1)]);
+            }
+        }
+
+        const Workload workload;
+        std::mt19937_64 random;
+
+        std::vector<std::string> licensePlates;
+        std::vector<std::string> roads;
+
+        std::vector<Drive> drives;
+        std::vector<bool> isDriving;
+
+        std::string buffer;
+    };
+}
+
+int main(int argc, char *argv[]) {
+    Workload workload;
+
+    if (!parseOptions(argc, argv, workload)) {
+        outputUsage(argv[0]);
+
+        return 1;
+    }
+
+    std::ios_base::sync_with_stdio(false);
+
+    LogGenerator(workload).generate();
+
+    std::cout.flush();
+
+    return std::cout ? 0 : 1;
+}
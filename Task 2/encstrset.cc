@@ -1,11 +1,38 @@
 #include "encstrset.h"
 
 #include <unordered_map>
-#include <unordered_set>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include <cassert>
 #include <climits>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <type_traits>
+#include <optional>
+#include <deque>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 // Printing debug messages.
 namespace {
@@ -16,10 +43,10 @@ namespace {
 #endif
 
     // Debug form of ciphered string - character's codes, separated by spaces, in 2-digit HEX form.
-    std::string hex_cipher(const std::string &cipher) {
+    std::string hex_cipher(std::string_view cipher) {
         std::ostringstream hex_form;
 
-        for (std::string::size_type i = 0; i < cipher.size(); i++) {
+        for (std::string_view::size_type i = 0; i < cipher.size(); i++) {
             hex_form << std::hex << std::uppercase
                      << std::setfill('0') << std::setw(2)
                      << static_cast<unsigned>(static_cast<unsigned char>(cipher[i]));
@@ -48,6 +75,45 @@ namespace {
         return str == nullptr ? "NULL" : out_form(std::string(str), surrounding);
     }
 
+    // String of a given size, which may contain null characters, passed to print_function_args.
+    struct SizedString {
+        const char *string;
+        size_t size;
+    };
+
+    // Debug form of string of a given size, surrounded by a given char.
+    std::string out_form(const SizedString &str, const char surrounding = '\"') {
+        return str.string == nullptr ? "NULL" : out_form(std::string(str.string, str.size), surrounding);
+    }
+
+    // Array of strings, passed to print_function_args. Strings have given
+    // sizes, or are C-strings if sizes is NULL.
+    struct StringsArray {
+        const char *const *strings;
+        const size_t *sizes;
+        size_t count;
+    };
+
+    // Debug form of array of strings, in the form {"str1", "str2", ..., "strn"}.
+    std::string out_form(const StringsArray &array) {
+        if (array.strings == nullptr) {
+            return "NULL";
+        }
+
+        std::string array_form = "{";
+
+        for (size_t i = 0; i < array.count; i++) {
+            array_form += array.sizes == nullptr ? out_form(array.strings[i])
+                                                 : out_form(SizedString{array.strings[i], array.sizes[i]});
+
+            if (i < array.count - 1) {
+                array_form += ", ";
+            }
+        }
+
+        return array_form + "}";
+    }
+
     // Prints empty argument list.
     void print_function_args() {
         std::cerr << "()" << std::endl;
@@ -77,199 +143,2168 @@ namespace {
 
 // Helper functions and structures for performing operations from encstrset interface.
 namespace {
-    // Set of ciphers.
-    using CiphersSet = std::unordered_set<std::string>;
+    // Whole file mapped read-only into memory, unmapped once no table reads it.
+    class FileMapping {
+    public:
+        // Maps file at path. Returns nullptr if it cannot be mapped.
+        static std::shared_ptr<const FileMapping> map(const char *path) {
+            const int descriptor = open(path, O_RDONLY | O_CLOEXEC);
+
+            if (descriptor < 0) {
+                return nullptr;
+            }
 
-    // Map id -> CiphersSet.
-    using CiphersSetByID = std::unordered_map<unsigned long, CiphersSet>;
+            struct stat status{};
+            void *data = MAP_FAILED;
 
-    // Getter for mapping from id to CiphersSet to avoid static initialization fiasco.
-    CiphersSetByID &get_set_by_id() {
-        static CiphersSetByID set_by_id;
+            if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+                data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+            }
 
-        return set_by_id;
-    }
+            close(descriptor);
 
-    // Returns value string XOR-ciphered by key string.
-    std::string ciphered_string(const std::string &value, const std::string &key) {
-        if (key.empty()) {
-            return value;
+            if (data == MAP_FAILED) {
+                return nullptr;
+            }
+
+            return std::shared_ptr<const FileMapping>(new FileMapping(static_cast<const char *>(data),
+                                                                      static_cast<size_t>(status.st_size)));
         }
 
-        std::string ciphered(value.size(), '\0');
+        FileMapping(const FileMapping &) = delete;
+        FileMapping &operator=(const FileMapping &) = delete;
 
-        for (std::string::size_type i = 0; i < value.size(); i++) {
-            ciphered[i] = value[i] ^ key[i % key.size()];
+        ~FileMapping() {
+            munmap(const_cast<char *>(data), size);
         }
 
-        return ciphered;
-    }
+        const char *const data;
+        const size_t size;
+
+    private:
+        FileMapping(const char *data, size_t size) : data(data), size(size) {}
+    };
+
+    // Table of ciphers in a flat open addressing hash table. Ciphers are stored
+    // one after another in an arena and slots of the table hold only their
+    // positions, together with fingerprints of their hashes, so that probes
+    // skip slots of other ciphers without reading the arena. Collisions are
+    // resolved by linear probing. Removal shifts following slots back instead
+    // of leaving tombstones, and the arena is compacted once at least half of
+    // it is taken by removed ciphers.
+    // A table loaded from a file reads its slots and arena from the mapped
+    // file in place, and copies them only when it changes for the first time.
+    // Ciphers are given together with their hashes.
+    class CiphersTable {
+    public:
+        struct Slot {
+            // Position of the cipher in the arena.
+            size_t offset = 0;
+            uint32_t size = 0;
+
+            // Lowest bits of the cipher's hash, which also choose its home
+            // slot, so ciphers are moved to a larger table without hashing
+            // them again.
+            uint32_t fingerprint = 0;
+        };
+
+        // Table laid out as in memory, which is also how it is stored in
+        // files: capacity slots, a power of two, of which non-empty ones
+        // point to ciphers in the arena.
+        struct Image {
+            const Slot *slots;
+            size_t capacity;
+            size_t count;
+            const char *arena;
+            size_t arena_size;
+        };
+
+        CiphersTable() = default;
+
+        // Table reading a given image, which lies in mapping, in place. The
+        // image is not trusted to be valid, apart from its slots and arena
+        // lying in mapping, so probes of its slots are bounded and slots
+        // pointing outside of its arena are ignored.
+        CiphersTable(const Image &image, std::shared_ptr<const FileMapping> mapping)
+                : count(image.count), mapping(std::move(mapping)), mapped(image) {}
+
+        // Reduces hash to its bits stored in slots, which are the only ones used by tables.
+        static uint32_t fingerprint_of(size_t hash) {
+            const auto fingerprint = static_cast<uint32_t>(hash);
+
+            return fingerprint == empty_fingerprint ? 1 : fingerprint;
+        }
 
-    // Merges functionality of encstrset_insert/remove/test by abstracting change to data structures.
-    template<typename T>
-    bool encstrset_change(unsigned long id, const char *value, const char *key,
-                          [[maybe_unused]] const char *name, T &&change) {
+        size_t size() const {
+            return count;
+        }
 
-        if (value == nullptr) {
-            PRINT_FUNC_DEBUG_MESSAGE(name, "invalid value (NULL)");
+        bool contains(std::string_view cipher, size_t hash) const {
+            if (mapping != nullptr) {
+                return mapped_contains(cipher, fingerprint_of(hash));
+            }
+
+            return count > 0 && slots[find(cipher, fingerprint_of(hash))].fingerprint != empty_fingerprint;
+        }
+
+        // Inserts cipher. Returns false if it was already present.
+        bool insert(std::string_view cipher, size_t hash) {
+            const uint32_t fingerprint = fingerprint_of(hash);
+
+            if (mapping != nullptr) {
+                if (mapped_contains(cipher, fingerprint)) {
+                    return false;
+                }
+
+                own();
+            }
+
+            if (count > 0 && slots[find(cipher, fingerprint)].fingerprint != empty_fingerprint) {
+                return false;
+            }
+
+            reserve(count + 1);
+
+            slots[find(cipher, fingerprint)] = {arena.size(), static_cast<uint32_t>(cipher.size()), fingerprint};
+            arena.append(cipher);
+            count++;
+
+            return true;
+        }
+
+        // Removes cipher. Returns false if it was not present.
+        bool erase(std::string_view cipher, size_t hash) {
+            if (mapping != nullptr) {
+                if (!mapped_contains(cipher, fingerprint_of(hash))) {
+                    return false;
+                }
+
+                own();
+            }
+
+            if (count == 0) {
+                return false;
+            }
+
+            size_t index = find(cipher, fingerprint_of(hash));
+
+            if (slots[index].fingerprint == empty_fingerprint) {
+                return false;
+            }
+
+            garbage_size += slots[index].size;
+            count--;
+
+            // Slots following the removed one move back, unless that would put them before their home slot.
+            for (size_t next = (index + 1) & mask(); slots[next].fingerprint != empty_fingerprint;
+                 next = (next + 1) & mask()) {
+
+                const size_t home = slots[next].fingerprint & mask();
+
+                if (((next - home) & mask()) >= ((next - index) & mask())) {
+                    slots[index] = slots[next];
+                    index = next;
+                }
+            }
+
+            slots[index] = Slot();
+
+            if (garbage_size >= min_compacted_size && 2 * garbage_size >= arena.size()) {
+                compact_arena();
+            }
+
+            return true;
+        }
+
+
+        // Hints the processor to fetch the slot where a probe for a cipher
+        // with a given hash starts, before it is needed.
+        void prefetch(size_t hash, bool for_writing) const {
+            const Image table = image();
+
+            if (table.capacity > 0) {
+                const Slot *slot = &table.slots[fingerprint_of(hash) & (table.capacity - 1)];
+
+                if (for_writing) {
+                    __builtin_prefetch(slot, 1);
+                } else {
+                    __builtin_prefetch(slot, 0);
+                }
+            }
+        }
+
+        // Makes room for a given number of ciphers without growing the table.
+        void reserve(size_t ciphers) {
+            own();
+
+            size_t capacity = slots.empty() ? min_capacity : slots.size();
+
+            while (ciphers * max_load_denominator > capacity * max_load_numerator) {
+                capacity *= 2;
+            }
+
+            if (capacity != slots.size()) {
+                rehash(capacity);
+            }
+        }
+
+        // Calls visit(cipher) for every cipher.
+        template<typename Visit>
+        void for_each(Visit &&visit) const {
+            for_each_hashed([&](std::string_view cipher, size_t) {
+                visit(cipher);
+            });
+        }
+
+        // Calls visit(cipher, hash) for every cipher, with its hash reduced to
+        // bits used by tables, which any table accepts instead of the whole one.
+        template<typename Visit>
+        void for_each_hashed(Visit &&visit) const {
+            const Image table = image();
+
+            for (size_t index = 0; index < table.capacity; index++) {
+                const Slot &slot = table.slots[index];
+
+                if (slot.fingerprint != empty_fingerprint && is_in_arena(table, slot)) {
+                    visit(std::string_view(table.arena + slot.offset, slot.size), size_t(slot.fingerprint));
+                }
+            }
+        }
+
+        // Returns image of the table, valid until it changes.
+        Image image() const {
+            return mapping != nullptr ? mapped : Image{slots.data(), slots.size(), count, arena.data(), arena.size()};
+        }
+
+        // Checks if the arena holds only present ciphers.
+        bool is_compact() const {
+            return garbage_size == 0;
+        }
+
+        // Copies present ciphers to a new arena, dropping removed ones.
+        void compact_arena() {
+            own();
+
+            std::string compacted;
+
+            compacted.reserve(arena.size() - garbage_size);
+
+            for (Slot &slot : slots) {
+                if (slot.fingerprint != empty_fingerprint) {
+                    const size_t offset = compacted.size();
+
+                    compacted.append(cipher_at(slot));
+                    slot.offset = offset;
+                }
+            }
+
+            arena.swap(compacted);
+            garbage_size = 0;
+        }
+
+    private:
+        static constexpr uint32_t empty_fingerprint = 0;
+        static constexpr size_t min_capacity = 16;
+        static constexpr size_t min_compacted_size = 4096;
+
+        // Maximal fraction of taken slots.
+        static constexpr size_t max_load_numerator = 3;
+        static constexpr size_t max_load_denominator = 4;
+
+        size_t mask() const {
+            return slots.size() - 1;
+        }
+
+        std::string_view cipher_at(const Slot &slot) const {
+            return std::string_view(arena.data() + slot.offset, slot.size);
+        }
+
+        static bool is_in_arena(const Image &table, const Slot &slot) {
+            return slot.offset <= table.arena_size && slot.size <= table.arena_size - slot.offset;
+        }
+
+        // Checks if the mapped image holds cipher with a given fingerprint.
+        // Unlike in find, probes stop after visiting every slot, as an image
+        // which is not valid may have no empty slots.
+        bool mapped_contains(std::string_view cipher, uint32_t fingerprint) const {
+            const size_t mapped_mask = mapped.capacity - 1;
+            size_t index = fingerprint & mapped_mask;
+
+            for (size_t probes = 0; probes < mapped.capacity; probes++, index = (index + 1) & mapped_mask) {
+                const Slot &slot = mapped.slots[index];
+
+                if (slot.fingerprint == empty_fingerprint) {
+                    return false;
+                }
+
+                if (slot.fingerprint == fingerprint && is_in_arena(mapped, slot)
+                    && std::string_view(mapped.arena + slot.offset, slot.size) == cipher) {
+
+                    return true;
+                }
+            }
 
             return false;
         }
 
-        auto iterator = get_set_by_id().find(id);
+        // Copies slots and arena of the mapped image to own ones, before the
+        // table changes, dropping slots pointing outside of the arena.
+        void own() {
+            if (mapping == nullptr) {
+                return;
+            }
 
-        if (iterator != get_set_by_id().end()) {
-            auto &ciphers_set = iterator->second;
+            slots.assign(mapped.slots, mapped.slots + mapped.capacity);
+            arena.assign(mapped.arena, mapped.arena_size);
+            mapping.reset();
 
-            std::string cipher = ciphered_string(value, key == nullptr ? "" : key);
+            size_t ciphers_size = 0;
 
-            // Performs requested change to data structures and returns result.
-            return change(ciphers_set, cipher);
+            count = 0;
+
+            for (Slot &slot : slots) {
+                if (slot.fingerprint != empty_fingerprint) {
+                    if (is_in_arena(mapped, slot)) {
+                        count++;
+                        ciphers_size += slot.size;
+                    } else {
+                        slot = Slot();
+                    }
+                }
+            }
+
+            garbage_size = arena.size() - ciphers_size;
+
+            // Grows the table if it is too full for probes to find an empty slot.
+            reserve(count);
         }
 
-        PRINT_FUNC_DEBUG_MESSAGE(name, "set #" << id << " does not exist");
+        // Returns index of the slot holding cipher with a given fingerprint,
+        // or of the empty slot where it would be inserted. The table must
+        // have at least one empty slot.
+        size_t find(std::string_view cipher, uint32_t fingerprint) const {
+            for (size_t index = fingerprint & mask();; index = (index + 1) & mask()) {
+                const Slot &slot = slots[index];
 
-        return false;
-    }
-}
+                if (slot.fingerprint == empty_fingerprint
+                    || (slot.fingerprint == fingerprint && cipher_at(slot) == cipher)) {
 
-namespace jnp1 {
-    unsigned long encstrset_new() {
-        // Every set is given next non-negative number, starting from 0.
-        static unsigned long set_counter = 0;
+                    return index;
+                }
+            }
+        }
 
-        assert(set_counter < ULONG_MAX);
+        // Moves ciphers to a table with a given number of slots, a power of two.
+        void rehash(size_t capacity) {
+            assert(capacity - 1 <= UINT32_MAX);
 
-        PRINT_FUNCTION();
+            std::vector<Slot> old_slots(capacity);
 
-        // Constructs empty set with id set_counter.
-        get_set_by_id()[set_counter];
+            old_slots.swap(slots);
 
-        PRINT_DEBUG_MESSAGE("set #" << set_counter << " created");
+            for (const Slot &slot : old_slots) {
+                if (slot.fingerprint != empty_fingerprint) {
+                    size_t index = slot.fingerprint & mask();
 
-        return set_counter++;
-    }
+                    while (slots[index].fingerprint != empty_fingerprint) {
+                        index = (index + 1) & mask();
+                    }
 
-    void encstrset_delete(unsigned long id) {
-        PRINT_FUNCTION(id);
+                    slots[index] = slot;
+                }
+            }
+        }
 
-        [[maybe_unused]] bool deleted = get_set_by_id().erase(id);
+        std::vector<Slot> slots;
+        size_t count = 0;
 
-        PRINT_DEBUG_MESSAGE("set #" << id << (deleted ? " deleted" : " does not exist"));
-    }
+        std::string arena;
 
-    size_t encstrset_size(unsigned long id) {
-        PRINT_FUNCTION(id);
+        // Total size of removed ciphers still in the arena.
+        size_t garbage_size = 0;
 
-        auto iterator = get_set_by_id().find(id);
+        // File holding the image read instead of own slots and arena, if any.
+        std::shared_ptr<const FileMapping> mapping;
+        Image mapped{};
+    };
 
-        if (iterator != get_set_by_id().end()) {
-            auto size = iterator->second.size();
+    // Pointer to a table shared by sets, counting sets which hold it. Unlike
+    // std::shared_ptr::use_count, the count is read with acquire ordering, so
+    // a set which finds that it holds the table alone also sees all reads of
+    // the table by sets which stopped holding it, and may change it in place.
+    class SharedTable {
+    public:
+        SharedTable() = default;
 
-            PRINT_DEBUG_MESSAGE("set #" << id << " contains " << size << " element(s)");
+        explicit SharedTable(CiphersTable table) : node(new Node{std::move(table), {1}}) {}
 
-            return size;
+        SharedTable(const SharedTable &other) : node(other.node) {
+            if (node != nullptr) {
+                node->holders.fetch_add(1, std::memory_order_relaxed);
+            }
         }
 
-        PRINT_DEBUG_MESSAGE("set #" << id << " does not exist");
+        SharedTable(SharedTable &&other) noexcept : node(other.node) {
+            other.node = nullptr;
+        }
 
-        return 0;
-    }
+        SharedTable &operator=(SharedTable other) noexcept {
+            std::swap(node, other.node);
 
-    bool encstrset_insert(unsigned long id, const char *value, const char *key) {
-        PRINT_FUNCTION(id, value, key);
+            return *this;
+        }
 
-        const auto &name = __func__;
+        ~SharedTable() {
+            if (node != nullptr && node->holders.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete node;
+            }
+        }
 
-        // Insert cipher into ciphers_set.
-        return encstrset_change(id, value, key, name, [&](CiphersSet &ciphers_set, const std::string &cipher) {
-            bool inserted = ciphers_set.insert(cipher).second;
+        bool is_shared() const {
+            return node != nullptr && node->holders.load(std::memory_order_acquire) > 1;
+        }
 
-            PRINT_FUNC_DEBUG_MESSAGE(name, "set #" << id << ", cypher " << out_form(hex_cipher(cipher))
-                                                   << (inserted ? " inserted" : " was already present"));
+        bool operator==(const SharedTable &other) const {
+            return node == other.node;
+        }
 
-            return inserted;
-        });
-    }
+        bool operator==(std::nullptr_t) const {
+            return node == nullptr;
+        }
 
-    bool encstrset_remove(unsigned long id, const char *value, const char *key) {
-        PRINT_FUNCTION(id, value, key);
+        bool operator!=(std::nullptr_t) const {
+            return node != nullptr;
+        }
 
-        const auto &name = __func__;
+        CiphersTable &operator*() const {
+            return node->table;
+        }
 
-        // Remove cipher from ciphers_set.
-        return encstrset_change(id, value, key, name, [&](CiphersSet &ciphers_set, const std::string &cipher) {
-            bool removed = ciphers_set.erase(cipher);
+        CiphersTable *operator->() const {
+            return &node->table;
+        }
 
-            PRINT_FUNC_DEBUG_MESSAGE(name, "set #" << id << ", cypher " << out_form(hex_cipher(cipher))
-                                                   << (removed ? " removed" : " was not present"));
+    private:
+        struct Node {
+            CiphersTable table;
+            std::atomic<size_t> holders;
+        };
+
+        Node *node = nullptr;
+    };
+
+    // Set of ciphers split by their hashes into parts, which are tables shared
+    // by copies of the set until one of them changes, so that copying a set
+    // into an empty one takes constant time. A change copies only the part
+    // it touches, and a copy into a non-empty set shares its parts which are
+    // empty in the destination and skips parts which are already shared.
+    // Small sets have a single part, split once they grow.
+    class CiphersSet {
+    public:
+        CiphersSet() : parts(1) {}
+
+        // Returns set of given parts, or nothing if there are not as many of
+        // them as in a set, either split or not. Every part must hold ciphers
+        // whose hashes choose it.
+        static std::optional<CiphersSet> of_parts(std::vector<SharedTable> parts) {
+            if (parts.size() != 1 && parts.size() != size_t(1) << split_bits) {
+                return std::nullopt;
+            }
 
-            return removed;
-        });
-    }
+            CiphersSet ciphers_set;
 
-    bool encstrset_test(unsigned long id, const char *value, const char *key) {
-        PRINT_FUNCTION(id, value, key);
+            ciphers_set.parts = std::move(parts);
 
-        const auto &name = __func__;
+            for (const auto &part : ciphers_set.parts) {
+                if (part != nullptr) {
+                    ciphers_set.count += part->size();
+                }
+            }
 
-        // Test if cipher is present in ciphers_set.
-        return encstrset_change(id, value, key, name, [&](CiphersSet &ciphers_set, const std::string &cipher) {
-            bool present = ciphers_set.count(cipher);
+            return ciphers_set;
+        }
 
-            PRINT_FUNC_DEBUG_MESSAGE(name, "set #" << id << ", cypher " << out_form(hex_cipher(cipher))
-                                                   << (present ? " is present" : " is not present"));
+        size_t size() const {
+            return count;
+        }
 
-            return present;
-        });
-    }
+        // Hash of cipher, which may be given to methods taking it together with the cipher.
+        static size_t hash_of(std::string_view cipher) {
+            return std::hash<std::string_view>()(cipher);
+        }
 
-    void encstrset_clear(unsigned long id) {
-        PRINT_FUNCTION(id);
+        bool contains(std::string_view cipher) const {
+            return contains(cipher, hash_of(cipher));
+        }
 
-        auto iterator = get_set_by_id().find(id);
+        bool contains(std::string_view cipher, size_t hash) const {
+            const auto &part = parts[part_of(hash)];
 
-        if (iterator != get_set_by_id().end()) {
-            iterator->second.clear();
+            return part != nullptr && part->contains(cipher, hash);
+        }
 
-            PRINT_DEBUG_MESSAGE("set #" << id << " cleared");
-        } else {
-            PRINT_DEBUG_MESSAGE("set #" << id << " does not exist");
+        // Inserts cipher. Returns false if it was already present.
+        bool insert(std::string_view cipher) {
+            return insert(cipher, hash_of(cipher));
         }
-    }
 
-    void encstrset_copy(unsigned long src_id, unsigned long dst_id) {
-        PRINT_FUNCTION(src_id, dst_id);
+        bool insert(std::string_view cipher, size_t hash) {
+            const size_t index = part_of(hash);
+
+            // A shared part is not copied if nothing changes.
+            if ((is_shared(index) && parts[index]->contains(cipher, hash))
+                || !mutable_part(index).insert(cipher, hash)) {
 
-        auto src_iterator = get_set_by_id().find(src_id);
+                return false;
+            }
 
-        if (src_iterator == get_set_by_id().end()) {
-            PRINT_DEBUG_MESSAGE("set #" << src_id << " does not exist");
+            count++;
 
-            return;
+            if (parts.size() == 1 && count > max_unsplit_size) {
+                split();
+            }
+
+            return true;
         }
 
-        auto dst_iterator = get_set_by_id().find(dst_id);
+        // Removes cipher. Returns false if it was not present.
+        bool erase(std::string_view cipher) {
+            const size_t hash = hash_of(cipher);
+            const size_t index = part_of(hash);
 
-        if (dst_iterator == get_set_by_id().end()) {
-            PRINT_DEBUG_MESSAGE("set #" << dst_id << " does not exist");
+            if (parts[index] == nullptr || (is_shared(index) && !parts[index]->contains(cipher, hash))
+                || !mutable_part(index).erase(cipher, hash)) {
 
-            return;
+                return false;
+            }
+
+            count--;
+
+            return true;
         }
 
-        const auto &src_ciphers_set = src_iterator->second;
-        auto &dst_ciphers_set = dst_iterator->second;
+        // Hints the processor to fetch the slot where a probe for a cipher
+        // with a given hash starts, before it is tested or inserted.
+        void prefetch(size_t hash, bool for_writing) const {
+            const auto &part = parts[part_of(hash)];
 
-        // Copy ciphers from src_ciphers_set to dst_ciphers_set one by one.
-        for (const std::string &cipher : src_ciphers_set) {
-            if (dst_ciphers_set.insert(cipher).second) {
-                PRINT_DEBUG_MESSAGE("cypher " << out_form(hex_cipher(cipher))
-                                              << " copied from set #" << src_id
-                                              << " to set #" << dst_id);
-            } else {
-                PRINT_DEBUG_MESSAGE("copied cypher " << out_form(hex_cipher(cipher))
-                                                     << " was already present in set #" << dst_id);
+            if (part != nullptr) {
+                part->prefetch(hash, for_writing);
             }
         }
-    }
-}
\ No newline at end of file
+
+        void clear() {
+            *this = CiphersSet();
+        }
+
+        // Inserts all ciphers of source. If report_each is true, calls
+        // report(cipher, inserted) for every cipher of source.
+        template<bool report_each, typename Report>
+        void copy_from(const CiphersSet &source, Report &&report) {
+            if (source.parts.size() > parts.size()) {
+                split();
+            }
+
+            if (source.parts.size() < parts.size()) {
+                source.for_each([&](std::string_view cipher) {
+                    report(cipher, insert(cipher));
+                });
+
+                return;
+            }
+
+            count += for_each_part<report_each>(source, [&](size_t index) -> size_t {
+                const auto &source_part = source.parts[index];
+                auto &part = parts[index];
+
+                if (source_part == nullptr || source_part->size() == 0) {
+                    return 0;
+                }
+
+                if (part == source_part) {
+                    if (report_each) {
+                        source_part->for_each([&](std::string_view cipher) { report(cipher, false); });
+                    }
+
+                    return 0;
+                }
+
+                if (part == nullptr || part->size() == 0) {
+                    part = source_part;
+
+                    if (report_each) {
+                        source_part->for_each([&](std::string_view cipher) { report(cipher, true); });
+                    }
+
+                    return source_part->size();
+                }
+
+                CiphersTable &table = mutable_part(index);
+                size_t inserted = 0;
+
+                table.reserve(table.size() + source_part->size());
+
+                source_part->for_each_hashed([&](std::string_view cipher, size_t hash) {
+                    const bool is_inserted = table.insert(cipher, hash);
+
+                    inserted += is_inserted;
+                    report(cipher, is_inserted);
+                });
+
+                return inserted;
+            });
+
+            if (parts.size() == 1 && count > max_unsplit_size) {
+                split();
+            }
+        }
+
+        // Removes ciphers which are not in source. If report_each is true,
+        // calls report(cipher) for every removed cipher.
+        template<bool report_each, typename Report>
+        void retain_all(const CiphersSet &source, Report &&report) {
+            // A small source is searched for ciphers of this set, and otherwise this small set for ciphers of source.
+            if (source.parts.size() < parts.size()) {
+                CiphersSet retained;
+
+                source.for_each([&](std::string_view cipher) {
+                    if (contains(cipher)) {
+                        retained.insert(cipher);
+                    }
+                });
+
+                if (report_each) {
+                    for_each([&](std::string_view cipher) {
+                        if (!retained.contains(cipher)) {
+                            report(cipher);
+                        }
+                    });
+                }
+
+                *this = std::move(retained);
+
+                return;
+            }
+
+            if (source.parts.size() > parts.size()) {
+                remove_if<report_each>([&](std::string_view cipher) { return !source.contains(cipher); }, report);
+
+                return;
+            }
+
+            count -= for_each_part<report_each>(source, [&](size_t index) -> size_t {
+                const auto &source_part = source.parts[index];
+
+                if (parts[index] == source_part) {
+                    return 0;
+                }
+
+                if (source_part == nullptr || source_part->size() == 0) {
+                    return clear_part<report_each>(index, report);
+                }
+
+                return filter_part<report_each>(index, [&](std::string_view cipher, size_t hash) {
+                    return source_part->contains(cipher, hash);
+                }, report);
+            });
+        }
+
+        // Removes ciphers which are in source. If report_each is true, calls
+        // report(cipher) for every removed cipher.
+        template<bool report_each, typename Report>
+        void remove_all(const CiphersSet &source, Report &&report) {
+            // Ciphers of a small source are removed one by one, and otherwise this small set is searched for them.
+            if (source.parts.size() < parts.size()) {
+                source.for_each([&](std::string_view cipher) {
+                    if (erase(cipher) && report_each) {
+                        report(cipher);
+                    }
+                });
+
+                return;
+            }
+
+            if (source.parts.size() > parts.size()) {
+                remove_if<report_each>([&](std::string_view cipher) { return source.contains(cipher); }, report);
+
+                return;
+            }
+
+            count -= for_each_part<report_each>(source, [&](size_t index) -> size_t {
+                const auto &source_part = source.parts[index];
+
+                if (source_part == nullptr || source_part->size() == 0) {
+                    return 0;
+                }
+
+                if (parts[index] == source_part) {
+                    return clear_part<report_each>(index, report);
+                }
+
+                return filter_part<report_each>(index, [&](std::string_view cipher, size_t hash) {
+                    return !source_part->contains(cipher, hash);
+                }, report);
+            });
+        }
+
+        // Calls visit(cipher) for every cipher.
+        template<typename Visit>
+        void for_each(Visit &&visit) const {
+            for (const auto &part : parts) {
+                if (part != nullptr) {
+                    part->for_each(visit);
+                }
+            }
+        }
+
+        // Calls visit(cipher, hash) for every cipher, with its hash reduced as by CiphersTable::for_each_hashed.
+        template<typename Visit>
+        void for_each_hashed(Visit &&visit) const {
+            for (const auto &part : parts) {
+                if (part != nullptr) {
+                    part->for_each_hashed(visit);
+                }
+            }
+        }
+
+        // Calls visit(table) for every part in order, with nullptr for an empty part.
+        template<typename Visit>
+        void for_each_table(Visit &&visit) const {
+            for (const auto &part : parts) {
+                visit(part == nullptr ? nullptr : &*part);
+            }
+        }
+
+    private:
+        // Number of parts of a split set is 2^split_bits.
+        static constexpr size_t split_bits = 6;
+        static constexpr size_t max_unsplit_size = 4096;
+
+        // Operations on sets with at least that many ciphers in total are
+        // spread over threads, part by part.
+        static constexpr size_t min_parallel_size = size_t(1) << 16;
+        static constexpr size_t hash_bits = std::numeric_limits<size_t>::digits;
+
+        // Parts are chosen by the highest bits of hashes, while tables use the lowest ones.
+        size_t part_of(size_t hash) const {
+            return parts.size() == 1 ? 0 : hash >> (hash_bits - split_bits);
+        }
+
+        // Runs process(index) for every part, on many threads if the sets are
+        // large, unless every cipher is reported. Every part is processed by
+        // one thread, which touches only that part of this set and of source.
+        // Returns sum of results.
+        template<bool report_each, typename Process>
+        size_t for_each_part(const CiphersSet &source, Process &&process) {
+            const size_t threads_count = std::min<size_t>(std::thread::hardware_concurrency(), parts.size());
+
+            if (report_each || threads_count <= 1 || count + source.count < min_parallel_size) {
+                size_t sum = 0;
+
+                for (size_t index = 0; index < parts.size(); index++) {
+                    sum += process(index);
+                }
+
+                return sum;
+            }
+
+            std::atomic<size_t> next_index{0};
+            std::atomic<size_t> sum{0};
+            std::vector<std::thread> threads;
+
+            auto work = [&] {
+                size_t index;
+
+                while ((index = next_index++) < parts.size()) {
+                    sum += process(index);
+                }
+            };
+
+            for (size_t thread = 1; thread < threads_count; thread++) {
+                threads.emplace_back(work);
+            }
+
+            work();
+
+            for (auto &thread : threads) {
+                thread.join();
+            }
+
+            return sum;
+        }
+
+        // Removes all ciphers of part with a given index. Returns their number.
+        template<bool report_each, typename Report>
+        size_t clear_part(size_t index, Report &&report) {
+            if (parts[index] == nullptr) {
+                return 0;
+            }
+
+            if (report_each) {
+                parts[index]->for_each(report);
+            }
+
+            const size_t removed = parts[index]->size();
+
+            parts[index] = SharedTable();
+
+            return removed;
+        }
+
+        // Replaces part with a given index by a table of its ciphers for which
+        // keep(cipher, hash) holds. Returns number of removed ciphers.
+        template<bool report_each, typename Keep, typename Report>
+        size_t filter_part(size_t index, Keep &&keep, Report &&report) {
+            if (parts[index] == nullptr) {
+                return 0;
+            }
+
+            const CiphersTable &table = *parts[index];
+            size_t kept = 0;
+
+            table.for_each_hashed([&](std::string_view cipher, size_t hash) {
+                kept += keep(cipher, hash);
+            });
+
+            if (kept == table.size()) {
+                return 0;
+            }
+
+            if (kept == 0) {
+                return clear_part<report_each>(index, report);
+            }
+
+            CiphersTable filtered;
+
+            filtered.reserve(kept);
+
+            table.for_each_hashed([&](std::string_view cipher, size_t hash) {
+                if (keep(cipher, hash)) {
+                    filtered.insert(cipher, hash);
+                } else if (report_each) {
+                    report(cipher);
+                }
+            });
+
+            const size_t removed = table.size() - kept;
+
+            parts[index] = SharedTable(std::move(filtered));
+
+            return removed;
+        }
+
+        // Removes ciphers for which remove(cipher) holds, one by one.
+        template<bool report_each, typename Remove, typename Report>
+        void remove_if(Remove &&remove, Report &&report) {
+            std::vector<std::string> removed;
+
+            for_each([&](std::string_view cipher) {
+                if (remove(cipher)) {
+                    removed.emplace_back(cipher);
+                }
+            });
+
+            for (const std::string &cipher : removed) {
+                erase(cipher);
+
+                if (report_each) {
+                    report(std::string_view(cipher));
+                }
+            }
+        }
+
+        bool is_shared(size_t index) const {
+            return parts[index].is_shared();
+        }
+
+        // Returns part with a given index, copying it first if it is shared
+        // with other sets, which could only read it.
+        CiphersTable &mutable_part(size_t index) {
+            auto &part = parts[index];
+
+            if (part == nullptr) {
+                part = SharedTable(CiphersTable());
+            } else if (is_shared(index)) {
+                part = SharedTable(*part);
+            }
+
+            return *part;
+        }
+
+        // Splits the only part of the set into all parts.
+        void split() {
+            if (parts.size() > 1) {
+                return;
+            }
+
+            const SharedTable whole = std::move(parts.front());
+
+            parts.assign(size_t(1) << split_bits, SharedTable());
+
+            if (whole != nullptr) {
+                whole->for_each([&](std::string_view cipher) {
+                    const size_t hash = hash_of(cipher);
+
+                    mutable_part(part_of(hash)).insert(cipher, hash);
+                });
+            }
+        }
+
+        // Parts may be nullptr if they are empty.
+        std::vector<SharedTable> parts;
+        size_t count = 0;
+    };
+
+    // Blocked Bloom filter of ciphers of a set, which answers most tests of
+    // absent ciphers without probing tables of the set. A cipher sets one bit
+    // in each word of a block chosen by its hash, so a test reads one block.
+    // Only hashes reduced to bits stored in slots of tables are used, so the
+    // filter is built from slots without hashing ciphers again. Removed
+    // ciphers cannot be cleared from the filter, so it is built again once
+    // they outnumber present ones, or once the set outgrows the filter.
+    class CiphersFilter {
+    public:
+        bool is_enabled() const {
+            return !blocks.empty();
+        }
+
+        // Builds the filter anew for ciphers of ciphers_set, enabling it.
+        void build(const CiphersSet &ciphers_set) {
+            size_t blocks_count = 1;
+
+            while (blocks_count * ciphers_per_block < ciphers_set.size()) {
+                blocks_count *= 2;
+            }
+
+            blocks.assign(blocks_count, Block());
+            removed_count = 0;
+
+            ciphers_set.for_each_hashed([&](std::string_view, size_t hash) {
+                add(hash);
+            });
+        }
+
+        // Disables the filter, freeing its memory.
+        void disable() {
+            std::vector<Block>().swap(blocks);
+            removed_count = 0;
+        }
+
+        // Returns false only if a cipher with a given hash is surely absent.
+        bool may_contain(size_t hash) const {
+            if (blocks.empty()) {
+                return true;
+            }
+
+            const uint32_t key = CiphersTable::fingerprint_of(hash);
+            const Block &block = blocks[block_of(key)];
+
+            for (size_t i = 0; i < block_words; i++) {
+                if ((block.words[i] & bit_of(key, i)) == 0) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        // Updates the filter after a cipher with a given hash was inserted into ciphers_set.
+        void inserted(const CiphersSet &ciphers_set, size_t hash) {
+            if (!is_enabled()) {
+                return;
+            }
+
+            if (ciphers_set.size() > blocks.size() * ciphers_per_block) {
+                build(ciphers_set);
+            } else {
+                add(hash);
+            }
+        }
+
+        // Updates the filter after a cipher was removed from ciphers_set.
+        void removed(const CiphersSet &ciphers_set) {
+            if (is_enabled() && ++removed_count > std::max(ciphers_set.size(), ciphers_per_block)) {
+                build(ciphers_set);
+            }
+        }
+
+        // Updates the filter after many ciphers of ciphers_set changed at once.
+        void changed(const CiphersSet &ciphers_set) {
+            if (is_enabled()) {
+                build(ciphers_set);
+            }
+        }
+
+        // Estimated probability that an absent cipher passes the filter,
+        // which is the mean over blocks of the probability that all its
+        // tested bits are set.
+        double false_positive_rate() const {
+            double sum = 0;
+
+            for (const Block &block : blocks) {
+                double probability = 1;
+
+                for (uint32_t word : block.words) {
+                    probability *= __builtin_popcount(word) / 32.0;
+                }
+
+                sum += probability;
+            }
+
+            return blocks.empty() ? 1 : sum / static_cast<double>(blocks.size());
+        }
+
+        // Size of the filter in bytes.
+        size_t memory_size() const {
+            return blocks.size() * sizeof(Block);
+        }
+
+    private:
+        static constexpr size_t block_words = 8;
+
+        // Filter has at least 16 bits for every cipher.
+        static constexpr size_t ciphers_per_block = 16;
+
+        // Odd multipliers choosing bits of words, one for each word.
+        static constexpr uint32_t salts[block_words] = {0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+                                                        0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31};
+
+        struct alignas(32) Block {
+            uint32_t words[block_words] = {};
+        };
+
+        size_t block_of(uint32_t key) const {
+            return static_cast<size_t>((key * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & (blocks.size() - 1);
+        }
+
+        static uint32_t bit_of(uint32_t key, size_t word) {
+            return uint32_t(1) << ((key * salts[word]) >> 27);
+        }
+
+        void add(size_t hash) {
+            const uint32_t key = CiphersTable::fingerprint_of(hash);
+            Block &block = blocks[block_of(key)];
+
+            for (size_t i = 0; i < block_words; i++) {
+                block.words[i] |= bit_of(key, i);
+            }
+        }
+
+        std::vector<Block> blocks;
+
+        // Number of ciphers removed since the filter was built.
+        size_t removed_count = 0;
+    };
+
+    // Set of ciphers guarded by its own lock. Operations which only read the
+    // set (test, size) share the lock, so they run in parallel. The set may
+    // have a filter, which changes together with it.
+    struct LockedCiphersSet {
+        mutable std::shared_mutex mutex;
+        CiphersSet ciphers;
+        CiphersFilter filter;
+    };
+
+    using ReadLock = std::shared_lock<std::shared_mutex>;
+    using WriteLock = std::unique_lock<std::shared_mutex>;
+
+    // Sets are shared with operations in progress, so a set deleted by another
+    // thread stays valid until they finish.
+    using CiphersSetPointer = std::shared_ptr<LockedCiphersSet>;
+
+    // Map id -> CiphersSet, safe for concurrent use. Ids are spread over
+    // shards with separate locks, so threads working on different sets
+    // rarely wait for each other.
+    class CiphersSetByID {
+    public:
+        // Adds set with a given id, empty unless ciphers are given.
+        void add(unsigned long id, CiphersSet ciphers = CiphersSet()) {
+            auto set = std::make_shared<LockedCiphersSet>();
+
+            set->ciphers = std::move(ciphers);
+
+            auto &shard = shard_of(id);
+            std::lock_guard<std::shared_mutex> lock(shard.mutex);
+
+            shard.sets[id] = std::move(set);
+        }
+
+        // Returns set with a given id or nullptr if it does not exist.
+        CiphersSetPointer find(unsigned long id) const {
+            const auto &shard = shard_of(id);
+            ReadLock lock(shard.mutex);
+
+            auto iterator = shard.sets.find(id);
+
+            return iterator == shard.sets.end() ? nullptr : iterator->second;
+        }
+
+        // Removes set with a given id. Returns false if it does not exist.
+        bool erase(unsigned long id) {
+            auto &shard = shard_of(id);
+            std::lock_guard<std::shared_mutex> lock(shard.mutex);
+
+            return shard.sets.erase(id);
+        }
+
+    private:
+        static constexpr size_t shards_count = 64;
+
+        struct Shard {
+            mutable std::shared_mutex mutex;
+            std::unordered_map<unsigned long, CiphersSetPointer> sets;
+        };
+
+        // Consecutive ids fall into different shards.
+        Shard &shard_of(unsigned long id) {
+            return shards[id % shards_count];
+        }
+
+        const Shard &shard_of(unsigned long id) const {
+            return shards[id % shards_count];
+        }
+
+        std::array<Shard, shards_count> shards;
+    };
+
+    // Returns id of a new set. Every set is given next non-negative number, starting from 0.
+    unsigned long next_set_id() {
+        static std::atomic<unsigned long> set_counter{0};
+
+        const unsigned long id = set_counter++;
+
+        assert(id < ULONG_MAX);
+
+        return id;
+    }
+
+    // Getter for mapping from id to CiphersSet to avoid static initialization fiasco.
+    CiphersSetByID &get_set_by_id() {
+        static CiphersSetByID set_by_id;
+
+        return set_by_id;
+    }
+
+    // XOR-ciphers size characters of value, starting at index begin, by key
+    // repeated cyclically, which is at index phase for the first character.
+    inline void cipher_scalar(char *ciphered, const char *value, size_t begin, size_t size,
+                              const char *key, size_t key_size, size_t phase) {
+
+        for (size_t i = begin; i < size; i++) {
+            ciphered[i] = static_cast<char>(value[i] ^ key[phase]);
+
+            if (++phase == key_size) {
+                phase = 0;
+            }
+        }
+    }
+
+    // Window of width consecutive characters of a cyclically repeated key,
+    // moving along the ciphered string, so that vector kernels load whole
+    // windows instead of computing an index of the key for every character.
+    template<size_t width>
+    class KeyWindow {
+    public:
+        KeyWindow(const char *key, size_t key_size)
+                : key(key), key_size(key_size), step(width % key_size) {
+
+            // Keys shorter than the window are repeated in it. Longer keys are
+            // read directly, apart from windows wrapping around their end.
+            size_t repeated_size = key_size < width ? key_size + width : 2 * width;
+            size_t index = key_size < width ? 0 : key_size - width;
+
+            for (size_t i = 0; i < repeated_size; i++) {
+                repeated[i] = key[index];
+
+                if (++index == key_size) {
+                    index = 0;
+                }
+            }
+        }
+
+        // Returns characters of the key for the next width characters of the ciphered string.
+        const char *next() {
+            const char *window;
+
+            if (key_size < width) {
+                window = repeated + phase;
+            } else if (phase + width <= key_size) {
+                window = key + phase;
+            } else {
+                window = repeated + (phase - (key_size - width));
+            }
+
+            phase += step;
+
+            if (phase >= key_size) {
+                phase -= key_size;
+            }
+
+            return window;
+        }
+
+        // Index of the key for the next character.
+        size_t get_phase() const {
+            return phase;
+        }
+
+    private:
+        const char *key;
+        const size_t key_size;
+        const size_t step;
+        size_t phase = 0;
+
+        char repeated[2 * width];
+    };
+
+    // Kernel XOR-ciphering size characters of value by non-empty key into ciphered.
+    using CipherKernel = void (*)(char *ciphered, const char *value, size_t size,
+                                  const char *key, size_t key_size);
+
+    void cipher_by_characters(char *ciphered, const char *value, size_t size,
+                              const char *key, size_t key_size) {
+
+        cipher_scalar(ciphered, value, 0, size, key, key_size, 0);
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("sse2")))
+    void cipher_by_sse2(char *ciphered, const char *value, size_t size,
+                        const char *key, size_t key_size) {
+
+        KeyWindow<16> window(key, key_size);
+        size_t i = 0;
+
+        for (; i + 16 <= size; i += 16) {
+            __m128i characters = _mm_loadu_si128(reinterpret_cast<const __m128i *>(value + i));
+            __m128i key_characters = _mm_loadu_si128(reinterpret_cast<const __m128i *>(window.next()));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(ciphered + i), _mm_xor_si128(characters, key_characters));
+        }
+
+        cipher_scalar(ciphered, value, i, size, key, key_size, window.get_phase());
+    }
+
+    __attribute__((target("avx2")))
+    void cipher_by_avx2(char *ciphered, const char *value, size_t size,
+                        const char *key, size_t key_size) {
+
+        KeyWindow<32> window(key, key_size);
+        size_t i = 0;
+
+        for (; i + 32 <= size; i += 32) {
+            __m256i characters = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(value + i));
+            __m256i key_characters = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(window.next()));
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(ciphered + i),
+                                _mm256_xor_si256(characters, key_characters));
+        }
+
+        cipher_scalar(ciphered, value, i, size, key, key_size, window.get_phase());
+    }
+#endif
+
+    // Getter for the fastest kernel supported by the processor, chosen once.
+    CipherKernel get_cipher_kernel() {
+        static const CipherKernel kernel = [] {
+#if defined(__x86_64__) || defined(__i386__)
+            if (__builtin_cpu_supports("avx2")) {
+                return &cipher_by_avx2;
+            }
+
+            if (__builtin_cpu_supports("sse2")) {
+                return &cipher_by_sse2;
+            }
+#endif
+            return &cipher_by_characters;
+        }();
+
+        return kernel;
+    }
+
+    // Strings shorter than that are ciphered without calling a vector kernel.
+    constexpr size_t min_vector_cipher_size = 16;
+
+    // XOR-ciphers size characters of value by key of key_size characters,
+    // repeated cyclically, into ciphered.
+    inline void cipher(char *ciphered, const char *value, size_t size, const char *key, size_t key_size) {
+        if (key_size == 0) {
+            std::copy(value, value + size, ciphered);
+        } else if (size < min_vector_cipher_size) {
+            cipher_scalar(ciphered, value, 0, size, key, key_size, 0);
+        } else {
+            get_cipher_kernel()(ciphered, value, size, key, key_size);
+        }
+    }
+
+    // Returns value string XOR-ciphered by key string. The result is stored in
+    // a buffer of the calling thread, valid until its next call, which keeps
+    // its capacity, so ciphering allocates memory only for a value longer than
+    // all previous ones.
+    std::string_view ciphered_string(std::string_view value, std::string_view key) {
+        thread_local std::string ciphered;
+
+        ciphered.resize(value.size());
+
+        cipher(ciphered.data(), value.data(), value.size(), key.data(), key.size());
+
+        return ciphered;
+    }
+
+    // Ciphers of a batch of values, stored one after another, with their hashes.
+    struct CiphersBatch {
+        std::string ciphers;
+
+        // Positions in ciphers where consecutive ciphers end.
+        std::vector<size_t> ends;
+
+        std::vector<size_t> hashes;
+
+        std::string_view cipher(size_t index) const {
+            const size_t begin = index == 0 ? 0 : ends[index - 1];
+
+            return std::string_view(ciphers.data() + begin, ends[index] - begin);
+        }
+    };
+
+    // Returns count values XOR-ciphered by key string, with hashes of ciphers.
+    // Values have sizes given in value_sizes, or are C-strings if it is NULL.
+    // Missing values (NULL) get empty ciphers. Every value is ciphered from
+    // the beginning of the key, so the key is repeated once to the length of
+    // the longest value, and then each value is ciphered by a prefix of it in
+    // a single pass of a vector kernel, which never wraps around the key.
+    // Like in ciphered_string, the result is stored in buffers of the calling
+    // thread, valid until its next call.
+    const CiphersBatch &ciphered_batch(const char *const *values, const size_t *value_sizes, size_t count,
+                                       std::string_view key) {
+
+        thread_local CiphersBatch batch;
+        thread_local std::string repeated_key;
+
+        size_t end = 0;
+        size_t max_size = 0;
+
+        batch.ends.resize(count);
+        batch.hashes.resize(count);
+
+        for (size_t i = 0; i < count; i++) {
+            const size_t size = values[i] == nullptr ? 0
+                                : value_sizes == nullptr ? std::strlen(values[i]) : value_sizes[i];
+
+            end += size;
+            batch.ends[i] = end;
+            max_size = std::max(max_size, size);
+        }
+
+        if (!key.empty() && key.size() < max_size) {
+            repeated_key.resize(max_size);
+
+            for (size_t i = 0; i < max_size; i += key.size()) {
+                key.copy(repeated_key.data() + i, max_size - i);
+            }
+
+            key = repeated_key;
+        }
+
+        batch.ciphers.resize(end);
+
+        for (size_t i = 0; i < count; i++) {
+            const size_t begin = i == 0 ? 0 : batch.ends[i - 1];
+
+            if (values[i] != nullptr) {
+                cipher(batch.ciphers.data() + begin, values[i], batch.ends[i] - begin, key.data(), key.size());
+            }
+
+            batch.hashes[i] = CiphersSet::hash_of(batch.cipher(i));
+        }
+
+        return batch;
+    }
+
+    // Size of C-string str, or 0 if it is NULL.
+    size_t size_of(const char *str) {
+        return str == nullptr ? 0 : std::strlen(str);
+    }
+
+    // Key of a given size. Missing key (NULL) is empty.
+    std::string_view key_of(const char *key, size_t key_size) {
+        return key == nullptr ? std::string_view() : std::string_view(key, key_size);
+    }
+
+    // Merges functionality of encstrset_insert/remove/test by abstracting change to data structures.
+    // Change is performed holding the set's lock of type Lock.
+    template<typename Lock, typename T>
+    bool encstrset_change(unsigned long id, const char *value, size_t value_size, std::string_view key,
+                          [[maybe_unused]] const char *name, T &&change) {
+
+        if (value == nullptr) {
+            PRINT_FUNC_DEBUG_MESSAGE(name, "invalid value (NULL)");
+
+            return false;
+        }
+
+        auto set = get_set_by_id().find(id);
+
+        if (set != nullptr) {
+            std::string_view cipher = ciphered_string(std::string_view(value, value_size), key);
+
+            Lock lock(set->mutex);
+
+            // Performs requested change to data structures and returns result.
+            return change(*set, cipher);
+        }
+
+        PRINT_FUNC_DEBUG_MESSAGE(name, "set #" << id << " does not exist");
+
+        return false;
+    }
+
+    // Probes for ciphers of a batch are prefetched that many ciphers ahead.
+    constexpr size_t prefetch_distance = 8;
+
+    // Merges functionality of encstrset_insert_many/test_many by abstracting change to data structures
+    // for every value of a batch, given with its cipher and hash. The set is found and ciphers are
+    // prepared once for the whole batch, and changes are performed holding the set's lock of type Lock.
+    // Results are stored in results, unless it is NULL. Returns number of true results.
+    template<typename Lock, typename T>
+    size_t encstrset_change_many(unsigned long id, const char *const *values, const size_t *value_sizes, size_t count,
+                                 std::string_view key, bool *results, [[maybe_unused]] const char *name, T &&change) {
+
+        if (results != nullptr) {
+            std::fill(results, results + count, false);
+        }
+
+        if (values == nullptr && count > 0) {
+            PRINT_FUNC_DEBUG_MESSAGE(name, "invalid values (NULL)");
+
+            return 0;
+        }
+
+        auto set = get_set_by_id().find(id);
+
+        if (set == nullptr) {
+            PRINT_FUNC_DEBUG_MESSAGE(name, "set #" << id << " does not exist");
+
+            return 0;
+        }
+
+        const CiphersBatch &batch = ciphered_batch(values, value_sizes, count, key);
+        constexpr bool for_writing = std::is_same_v<Lock, WriteLock>;
+        size_t true_results = 0;
+
+        Lock lock(set->mutex);
+
+        for (size_t i = 0; i < std::min(count, prefetch_distance); i++) {
+            set->ciphers.prefetch(batch.hashes[i], for_writing);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            if (i + prefetch_distance < count) {
+                set->ciphers.prefetch(batch.hashes[i + prefetch_distance], for_writing);
+            }
+
+            if (values[i] == nullptr) {
+                PRINT_FUNC_DEBUG_MESSAGE(name, "invalid value (NULL)");
+
+                continue;
+            }
+
+            // Performs requested change to data structures.
+            if (change(*set, batch.cipher(i), batch.hashes[i])) {
+                true_results++;
+
+                if (results != nullptr) {
+                    results[i] = true;
+                }
+            }
+        }
+
+        return true_results;
+    }
+
+    // Merges functionality of encstrset_copy/union/intersect/difference by abstracting combination
+    // of two sets. Combination is performed holding a read lock of the source set and a write lock
+    // of the destination set, which may be the same set.
+    template<typename T>
+    void encstrset_combine(unsigned long src_id, unsigned long dst_id,
+                           [[maybe_unused]] const char *name, T &&combine) {
+
+        auto src_set = get_set_by_id().find(src_id);
+
+        if (src_set == nullptr) {
+            PRINT_FUNC_DEBUG_MESSAGE(name, "set #" << src_id << " does not exist");
+
+            return;
+        }
+
+        auto dst_set = get_set_by_id().find(dst_id);
+
+        if (dst_set == nullptr) {
+            PRINT_FUNC_DEBUG_MESSAGE(name, "set #" << dst_id << " does not exist");
+
+            return;
+        }
+
+        // A set combined with itself must not be locked twice.
+        ReadLock src_lock(src_set->mutex, std::defer_lock);
+        WriteLock dst_lock(dst_set->mutex, std::defer_lock);
+
+        if (src_set == dst_set) {
+            dst_lock.lock();
+        } else {
+            std::lock(src_lock, dst_lock);
+        }
+
+        combine(src_set->ciphers, dst_set->ciphers);
+
+        dst_set->filter.changed(dst_set->ciphers);
+    }
+
+    // Copies ciphers of set src_id to set dst_id, for encstrset_copy and encstrset_union.
+    void copy_ciphers(unsigned long src_id, unsigned long dst_id, const char *name) {
+        encstrset_combine(src_id, dst_id, name, [&](const CiphersSet &src_ciphers_set, CiphersSet &dst_ciphers_set) {
+            // Copy ciphers from src_ciphers_set to dst_ciphers_set, sharing their storage where possible.
+            dst_ciphers_set.copy_from<debug>(src_ciphers_set, [&](std::string_view cipher,
+                                                                 [[maybe_unused]] bool copied) {
+                if (copied) {
+                    PRINT_FUNC_DEBUG_MESSAGE(name, "cypher " << out_form(hex_cipher(cipher))
+                                                             << " copied from set #" << src_id
+                                                             << " to set #" << dst_id);
+                } else {
+                    PRINT_FUNC_DEBUG_MESSAGE(name, "copied cypher " << out_form(hex_cipher(cipher))
+                                                                    << " was already present in set #" << dst_id);
+                }
+            });
+        });
+    }
+
+    // Inserts value ciphered by key into set id, for encstrset_insert and encstrset_insert_n.
+    bool insert_value(unsigned long id, const char *value, size_t value_size, std::string_view key,
+                      const char *name) {
+
+        // Insert cipher into ciphers_set.
+        return encstrset_change<WriteLock>(id, value, value_size, key, name, [&](LockedCiphersSet &set,
+                                                                                 std::string_view cipher) {
+            const size_t hash = CiphersSet::hash_of(cipher);
+            bool inserted = set.ciphers.insert(cipher, hash);
+
+            if (inserted) {
+                set.filter.inserted(set.ciphers, hash);
+            }
+
+            PRINT_FUNC_DEBUG_MESSAGE(name, "set #" << id << ", cypher " << out_form(hex_cipher(cipher))
+                                                   << (inserted ? " inserted" : " was already present"));
+
+            return inserted;
+        });
+    }
+
+    // Inserts values ciphered by key into set id, for encstrset_insert_many and encstrset_insert_many_n.
+    size_t insert_values(unsigned long id, const char *const *values, const size_t *value_sizes, size_t count,
+                         std::string_view key, bool *results, const char *name) {
+
+        // Insert cipher into ciphers_set.
+        return encstrset_change_many<WriteLock>(id, values, value_sizes, count, key, results, name,
+                                                [&](LockedCiphersSet &set, std::string_view cipher, size_t hash) {
+            bool inserted = set.ciphers.insert(cipher, hash);
+
+            if (inserted) {
+                set.filter.inserted(set.ciphers, hash);
+            }
+
+            PRINT_FUNC_DEBUG_MESSAGE(name, "set #" << id << ", cypher " << out_form(hex_cipher(cipher))
+                                                   << (inserted ? " inserted" : " was already present"));
+
+            return inserted;
+        });
+    }
+
+    // Removes value ciphered by key from set id, for encstrset_remove and encstrset_remove_n.
+    bool remove_value(unsigned long id, const char *value, size_t value_size, std::string_view key,
+                      const char *name) {
+
+        // Remove cipher from ciphers_set.
+        return encstrset_change<WriteLock>(id, value, value_size, key, name, [&](LockedCiphersSet &set,
+                                                                                 std::string_view cipher) {
+            bool removed = set.ciphers.erase(cipher);
+
+            if (removed) {
+                set.filter.removed(set.ciphers);
+            }
+
+            PRINT_FUNC_DEBUG_MESSAGE(name, "set #" << id << ", cypher " << out_form(hex_cipher(cipher))
+                                                   << (removed ? " removed" : " was not present"));
+
+            return removed;
+        });
+    }
+
+    // Tests if value ciphered by key is in set id, for encstrset_test and encstrset_test_n.
+    bool test_value(unsigned long id, const char *value, size_t value_size, std::string_view key,
+                    const char *name) {
+
+        // Test if cipher is present in ciphers_set.
+        return encstrset_change<ReadLock>(id, value, value_size, key, name, [&](const LockedCiphersSet &set,
+                                                                                std::string_view cipher) {
+            // Absent ciphers rejected by the filter are not searched for in tables.
+            const size_t hash = CiphersSet::hash_of(cipher);
+            bool present = set.filter.may_contain(hash) && set.ciphers.contains(cipher, hash);
+
+            PRINT_FUNC_DEBUG_MESSAGE(name, "set #" << id << ", cypher " << out_form(hex_cipher(cipher))
+                                                   << (present ? " is present" : " is not present"));
+
+            return present;
+        });
+    }
+
+    // Tests if values ciphered by key are in set id, for encstrset_test_many and encstrset_test_many_n.
+    size_t test_values(unsigned long id, const char *const *values, const size_t *value_sizes, size_t count,
+                       std::string_view key, bool *results, const char *name) {
+
+        // Test if cipher is present in ciphers_set.
+        return encstrset_change_many<ReadLock>(id, values, value_sizes, count, key, results, name,
+                                               [&](const LockedCiphersSet &set, std::string_view cipher, size_t hash) {
+            bool present = set.filter.may_contain(hash) && set.ciphers.contains(cipher, hash);
+
+            PRINT_FUNC_DEBUG_MESSAGE(name, "set #" << id << ", cypher " << out_form(hex_cipher(cipher))
+                                                   << (present ? " is present" : " is not present"));
+
+            return present;
+        });
+    }
+}
+
+// Saving sets to files and loading them.
+namespace {
+    // Files hold tables of parts of a set laid out as in memory, so that a
+    // loaded set reads them in place from the mapped file. A file starts with
+    // a FileHeader and a FilePart for every part, followed by slots and arenas
+    // of parts, with slots starting at multiples of file_alignment. Numbers
+    // are stored in the byte order of the machine which saved the file.
+    struct FileHeader {
+        char magic[8];
+
+        // Size of a slot, which differs between 32-bit and 64-bit machines.
+        uint64_t slot_size;
+
+        // Hash of hash_check_cipher, which tells if the file was saved with
+        // the same hash function as used by the machine loading it.
+        uint64_t hash_check;
+
+        uint64_t parts_count;
+    };
+
+    // Table of an empty part has capacity 0.
+    struct FilePart {
+        uint64_t capacity;
+        uint64_t count;
+        uint64_t slots_offset;
+        uint64_t arena_offset;
+        uint64_t arena_size;
+    };
+
+    constexpr char file_magic[8] = {'E', 'N', 'C', 'S', 'E', 'T', '0', '1'};
+    constexpr size_t file_alignment = 64;
+    constexpr std::string_view hash_check_cipher = "encstrset";
+
+    size_t file_aligned(size_t offset) {
+        return (offset + file_alignment - 1) / file_alignment * file_alignment;
+    }
+
+    // Writes size bytes of data to a file. Returns false on error.
+    bool write_all(int descriptor, const void *data, size_t size) {
+        const char *bytes = static_cast<const char *>(data);
+
+        while (size > 0) {
+            const ssize_t written = write(descriptor, bytes, size);
+
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return false;
+            }
+
+            bytes += written;
+            size -= static_cast<size_t>(written);
+        }
+
+        return true;
+    }
+
+    // Writes ciphers_set to a file. Returns false on error.
+    bool write_set(int descriptor, const CiphersSet &ciphers_set) {
+        static constexpr char padding[file_alignment] = {};
+
+        std::vector<CiphersTable::Image> images;
+
+        // Copies of tables with removed ciphers in their arenas, compacted
+        // before they are written. Adding a table does not move other ones.
+        std::deque<CiphersTable> compacted_tables;
+
+        ciphers_set.for_each_table([&](const CiphersTable *table) {
+            if (table == nullptr) {
+                images.push_back(CiphersTable::Image{nullptr, 0, 0, nullptr, 0});
+            } else if (table->is_compact()) {
+                images.push_back(table->image());
+            } else {
+                compacted_tables.push_back(*table);
+                compacted_tables.back().compact_arena();
+                images.push_back(compacted_tables.back().image());
+            }
+        });
+
+        FileHeader header{};
+        std::vector<FilePart> file_parts;
+        size_t offset = file_aligned(sizeof(FileHeader) + images.size() * sizeof(FilePart));
+
+        std::copy(std::begin(file_magic), std::end(file_magic), header.magic);
+        header.slot_size = sizeof(CiphersTable::Slot);
+        header.hash_check = CiphersSet::hash_of(hash_check_cipher);
+        header.parts_count = images.size();
+
+        for (const auto &image : images) {
+            const size_t arena_offset = offset + image.capacity * sizeof(CiphersTable::Slot);
+
+            file_parts.push_back({image.capacity, image.count, offset, arena_offset, image.arena_size});
+            offset = file_aligned(arena_offset + image.arena_size);
+        }
+
+        if (!write_all(descriptor, &header, sizeof(header))
+            || !write_all(descriptor, file_parts.data(), file_parts.size() * sizeof(FilePart))) {
+
+            return false;
+        }
+
+        size_t position = sizeof(FileHeader) + file_parts.size() * sizeof(FilePart);
+
+        for (size_t i = 0; i < images.size(); i++) {
+            if (!write_all(descriptor, padding, file_parts[i].slots_offset - position)
+                || !write_all(descriptor, images[i].slots, images[i].capacity * sizeof(CiphersTable::Slot))
+                || !write_all(descriptor, images[i].arena, images[i].arena_size)) {
+
+                return false;
+            }
+
+            position = file_parts[i].arena_offset + file_parts[i].arena_size;
+        }
+
+        return true;
+    }
+
+    // Saves ciphers_set to a file at path. The file is replaced only once the
+    // whole set is written, so sets loaded from it before keep reading the
+    // old file, and a failed save leaves it intact. Returns false on error.
+    bool save_set(const CiphersSet &ciphers_set, const char *path) {
+        std::string temporary_path = std::string(path) + ".XXXXXX";
+        const int descriptor = mkstemp(temporary_path.data());
+
+        if (descriptor < 0) {
+            return false;
+        }
+
+        bool saved = write_set(descriptor, ciphers_set) && fsync(descriptor) == 0;
+
+        saved = close(descriptor) == 0 && saved;
+        saved = saved && std::rename(temporary_path.c_str(), path) == 0;
+
+        if (!saved) {
+            unlink(temporary_path.c_str());
+        }
+
+        return saved;
+    }
+
+    // Checks if size bytes at offset lie in the file.
+    bool is_in_file(const FileMapping &file, uint64_t offset, uint64_t size) {
+        return offset <= file.size && size <= file.size - offset;
+    }
+
+    // Reads a record of type Record at offset of the file. Returns false if it does not lie in the file.
+    template<typename Record>
+    bool read_record(const FileMapping &file, uint64_t offset, Record &record) {
+        if (!is_in_file(file, offset, sizeof(Record))) {
+            return false;
+        }
+
+        std::memcpy(&record, file.data + offset, sizeof(Record));
+
+        return true;
+    }
+
+    // Returns table of a part described by file_part, which reads the file
+    // in place, or nothing if the table does not lie in the file.
+    std::optional<SharedTable> load_part(const std::shared_ptr<const FileMapping> &file, const FilePart &file_part) {
+        using Slot = CiphersTable::Slot;
+
+        if (file_part.capacity == 0) {
+            return file_part.count == 0 ? std::optional<SharedTable>(SharedTable()) : std::nullopt;
+        }
+
+        const bool is_valid = (file_part.capacity & (file_part.capacity - 1)) == 0
+                              && file_part.capacity - 1 <= UINT32_MAX
+                              && file_part.count <= file_part.capacity
+                              && file_part.slots_offset % alignof(Slot) == 0
+                              && file_part.capacity <= file->size / sizeof(Slot)
+                              && is_in_file(*file, file_part.slots_offset, file_part.capacity * sizeof(Slot))
+                              && is_in_file(*file, file_part.arena_offset, file_part.arena_size);
+
+        if (!is_valid) {
+            return std::nullopt;
+        }
+
+        const CiphersTable::Image image{reinterpret_cast<const Slot *>(file->data + file_part.slots_offset),
+                                        static_cast<size_t>(file_part.capacity),
+                                        static_cast<size_t>(file_part.count),
+                                        file->data + file_part.arena_offset,
+                                        static_cast<size_t>(file_part.arena_size)};
+
+        return SharedTable(CiphersTable(image, file));
+    }
+
+    // Loads set saved to a file at path. Returns nothing if the file cannot
+    // be mapped or was not saved by encstrset_save.
+    std::optional<CiphersSet> load_set(const char *path) {
+        const auto file = FileMapping::map(path);
+        FileHeader header{};
+
+        if (file == nullptr || !read_record(*file, 0, header)
+            || !std::equal(std::begin(file_magic), std::end(file_magic), header.magic)
+            || header.slot_size != sizeof(CiphersTable::Slot) || header.parts_count > file->size / sizeof(FilePart)) {
+
+            return std::nullopt;
+        }
+
+        std::vector<SharedTable> parts;
+
+        for (uint64_t i = 0; i < header.parts_count; i++) {
+            FilePart file_part{};
+
+            if (!read_record(*file, sizeof(FileHeader) + i * sizeof(FilePart), file_part)) {
+                return std::nullopt;
+            }
+
+            auto part = load_part(file, file_part);
+
+            if (!part) {
+                return std::nullopt;
+            }
+
+            parts.push_back(std::move(*part));
+        }
+
+        auto ciphers_set = CiphersSet::of_parts(std::move(parts));
+
+        // With another hash function, ciphers belong to other parts and slots, so they are inserted again.
+        if (ciphers_set && header.hash_check != CiphersSet::hash_of(hash_check_cipher)) {
+            CiphersSet rehashed;
+
+            ciphers_set->for_each([&](std::string_view cipher) {
+                rehashed.insert(cipher);
+            });
+
+            return rehashed;
+        }
+
+        return ciphers_set;
+    }
+}
+
+namespace jnp1 {
+    unsigned long encstrset_new() {
+        PRINT_FUNCTION();
+
+        const unsigned long id = next_set_id();
+
+        // Constructs empty set with id.
+        get_set_by_id().add(id);
+
+        PRINT_DEBUG_MESSAGE("set #" << id << " created");
+
+        return id;
+    }
+
+    void encstrset_delete(unsigned long id) {
+        PRINT_FUNCTION(id);
+
+        [[maybe_unused]] bool deleted = get_set_by_id().erase(id);
+
+        PRINT_DEBUG_MESSAGE("set #" << id << (deleted ? " deleted" : " does not exist"));
+    }
+
+    size_t encstrset_size(unsigned long id) {
+        PRINT_FUNCTION(id);
+
+        auto set = get_set_by_id().find(id);
+
+        if (set != nullptr) {
+            ReadLock lock(set->mutex);
+
+            auto size = set->ciphers.size();
+
+            PRINT_DEBUG_MESSAGE("set #" << id << " contains " << size << " element(s)");
+
+            return size;
+        }
+
+        PRINT_DEBUG_MESSAGE("set #" << id << " does not exist");
+
+        return 0;
+    }
+
+    bool encstrset_insert(unsigned long id, const char *value, const char *key) {
+        PRINT_FUNCTION(id, value, key);
+
+        return insert_value(id, value, size_of(value), key_of(key, size_of(key)), __func__);
+    }
+
+    bool encstrset_insert_n(unsigned long id, const char *value, size_t value_size,
+                            const char *key, size_t key_size) {
+
+        PRINT_FUNCTION(id, SizedString{value, value_size}, value_size, SizedString{key, key_size}, key_size);
+
+        return insert_value(id, value, value_size, key_of(key, key_size), __func__);
+    }
+
+    size_t encstrset_insert_many(unsigned long id, const char *const *values, size_t count, const char *key,
+                                 bool *results) {
+
+        PRINT_FUNCTION(id, StringsArray{values, nullptr, count}, count, key);
+
+        return insert_values(id, values, nullptr, count, key_of(key, size_of(key)), results, __func__);
+    }
+
+    size_t encstrset_insert_many_n(unsigned long id, const char *const *values, const size_t *value_sizes,
+                                   size_t count, const char *key, size_t key_size, bool *results) {
+
+        PRINT_FUNCTION(id, StringsArray{values, value_sizes, count}, count, SizedString{key, key_size}, key_size);
+
+        return insert_values(id, values, value_sizes, count, key_of(key, key_size), results, __func__);
+    }
+
+    bool encstrset_remove(unsigned long id, const char *value, const char *key) {
+        PRINT_FUNCTION(id, value, key);
+
+        return remove_value(id, value, size_of(value), key_of(key, size_of(key)), __func__);
+    }
+
+    bool encstrset_remove_n(unsigned long id, const char *value, size_t value_size,
+                            const char *key, size_t key_size) {
+
+        PRINT_FUNCTION(id, SizedString{value, value_size}, value_size, SizedString{key, key_size}, key_size);
+
+        return remove_value(id, value, value_size, key_of(key, key_size), __func__);
+    }
+
+    bool encstrset_test(unsigned long id, const char *value, const char *key) {
+        PRINT_FUNCTION(id, value, key);
+
+        return test_value(id, value, size_of(value), key_of(key, size_of(key)), __func__);
+    }
+
+    bool encstrset_test_n(unsigned long id, const char *value, size_t value_size,
+                          const char *key, size_t key_size) {
+
+        PRINT_FUNCTION(id, SizedString{value, value_size}, value_size, SizedString{key, key_size}, key_size);
+
+        return test_value(id, value, value_size, key_of(key, key_size), __func__);
+    }
+
+    size_t encstrset_test_many(unsigned long id, const char *const *values, size_t count, const char *key,
+                               bool *results) {
+
+        PRINT_FUNCTION(id, StringsArray{values, nullptr, count}, count, key);
+
+        return test_values(id, values, nullptr, count, key_of(key, size_of(key)), results, __func__);
+    }
+
+    size_t encstrset_test_many_n(unsigned long id, const char *const *values, const size_t *value_sizes,
+                                 size_t count, const char *key, size_t key_size, bool *results) {
+
+        PRINT_FUNCTION(id, StringsArray{values, value_sizes, count}, count, SizedString{key, key_size}, key_size);
+
+        return test_values(id, values, value_sizes, count, key_of(key, key_size), results, __func__);
+    }
+
+    void encstrset_clear(unsigned long id) {
+        PRINT_FUNCTION(id);
+
+        auto set = get_set_by_id().find(id);
+
+        if (set != nullptr) {
+            WriteLock lock(set->mutex);
+
+            set->ciphers.clear();
+            set->filter.changed(set->ciphers);
+
+            PRINT_DEBUG_MESSAGE("set #" << id << " cleared");
+        } else {
+            PRINT_DEBUG_MESSAGE("set #" << id << " does not exist");
+        }
+    }
+
+    void encstrset_copy(unsigned long src_id, unsigned long dst_id) {
+        PRINT_FUNCTION(src_id, dst_id);
+
+        copy_ciphers(src_id, dst_id, __func__);
+    }
+
+    void encstrset_union(unsigned long src_id, unsigned long dst_id) {
+        PRINT_FUNCTION(src_id, dst_id);
+
+        copy_ciphers(src_id, dst_id, __func__);
+    }
+
+    void encstrset_intersect(unsigned long src_id, unsigned long dst_id) {
+        PRINT_FUNCTION(src_id, dst_id);
+
+        const auto &name = __func__;
+
+        // Remove ciphers absent from src_ciphers_set from dst_ciphers_set, part by part.
+        encstrset_combine(src_id, dst_id, name, [&](const CiphersSet &src_ciphers_set, CiphersSet &dst_ciphers_set) {
+            dst_ciphers_set.retain_all<debug>(src_ciphers_set, [&]([[maybe_unused]] std::string_view cipher) {
+                PRINT_FUNC_DEBUG_MESSAGE(name, "cypher " << out_form(hex_cipher(cipher))
+                                                         << " absent from set #" << src_id
+                                                         << " removed from set #" << dst_id);
+            });
+        });
+    }
+
+    void encstrset_difference(unsigned long src_id, unsigned long dst_id) {
+        PRINT_FUNCTION(src_id, dst_id);
+
+        const auto &name = __func__;
+
+        // Remove ciphers present in src_ciphers_set from dst_ciphers_set, part by part.
+        encstrset_combine(src_id, dst_id, name, [&](const CiphersSet &src_ciphers_set, CiphersSet &dst_ciphers_set) {
+            dst_ciphers_set.remove_all<debug>(src_ciphers_set, [&]([[maybe_unused]] std::string_view cipher) {
+                PRINT_FUNC_DEBUG_MESSAGE(name, "cypher " << out_form(hex_cipher(cipher))
+                                                         << " present in set #" << src_id
+                                                         << " removed from set #" << dst_id);
+            });
+        });
+    }
+
+    bool encstrset_save(unsigned long id, const char *path) {
+        PRINT_FUNCTION(id, path);
+
+        if (path == nullptr) {
+            PRINT_DEBUG_MESSAGE("invalid path (NULL)");
+
+            return false;
+        }
+
+        auto set = get_set_by_id().find(id);
+
+        if (set == nullptr) {
+            PRINT_DEBUG_MESSAGE("set #" << id << " does not exist");
+
+            return false;
+        }
+
+        // The copy shares tables with the set, so the set may change while the copy is written.
+        CiphersSet ciphers_set;
+
+        {
+            ReadLock lock(set->mutex);
+
+            ciphers_set = set->ciphers;
+        }
+
+        const bool saved = save_set(ciphers_set, path);
+
+        PRINT_DEBUG_MESSAGE("set #" << id << (saved ? " saved to " : " could not be saved to ") << out_form(path));
+
+        return saved;
+    }
+
+    unsigned long encstrset_load(const char *path) {
+        PRINT_FUNCTION(out_form(path));
+
+        if (path == nullptr) {
+            PRINT_DEBUG_MESSAGE("invalid path (NULL)");
+
+            return ULONG_MAX;
+        }
+
+        auto ciphers_set = load_set(path);
+
+        if (!ciphers_set) {
+            PRINT_DEBUG_MESSAGE("set could not be loaded from " << out_form(path));
+
+            return ULONG_MAX;
+        }
+
+        const unsigned long id = next_set_id();
+
+        get_set_by_id().add(id, std::move(*ciphers_set));
+
+        PRINT_DEBUG_MESSAGE("set #" << id << " loaded from " << out_form(path));
+
+        return id;
+    }
+
+    bool encstrset_filter(unsigned long id, bool enabled) {
+        PRINT_FUNCTION(id, enabled);
+
+        auto set = get_set_by_id().find(id);
+
+        if (set == nullptr) {
+            PRINT_DEBUG_MESSAGE("set #" << id << " does not exist");
+
+            return false;
+        }
+
+        WriteLock lock(set->mutex);
+
+        if (!enabled) {
+            set->filter.disable();
+
+            PRINT_DEBUG_MESSAGE("set #" << id << " filter disabled");
+        } else if (!set->filter.is_enabled()) {
+            set->filter.build(set->ciphers);
+
+            PRINT_DEBUG_MESSAGE("set #" << id << " filter enabled");
+        } else {
+            PRINT_DEBUG_MESSAGE("set #" << id << " filter was already enabled");
+        }
+
+        return true;
+    }
+
+    bool encstrset_filter_stats(unsigned long id, double *false_positive_rate, size_t *memory_size) {
+        PRINT_FUNCTION(id);
+
+        auto set = get_set_by_id().find(id);
+
+        if (set == nullptr) {
+            PRINT_DEBUG_MESSAGE("set #" << id << " does not exist");
+
+            return false;
+        }
+
+        ReadLock lock(set->mutex);
+
+        if (!set->filter.is_enabled()) {
+            PRINT_DEBUG_MESSAGE("set #" << id << " has no filter");
+
+            return false;
+        }
+
+        const double rate = set->filter.false_positive_rate();
+        const size_t size = set->filter.memory_size();
+
+        if (false_positive_rate != nullptr) {
+            *false_positive_rate = rate;
+        }
+
+        if (memory_size != nullptr) {
+            *memory_size = size;
+        }
+
+        PRINT_DEBUG_MESSAGE("set #" << id << " filter has false positive rate " << rate << ", " << size << " byte(s)");
+
+        return true;
+    }
+}
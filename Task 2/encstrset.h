@@ -17,6 +17,10 @@ extern "C" {
 #include <stddef.h>
 #endif // __cplusplus
 
+        /* Wszystkie funkcje można wywoływać współbieżnie z wielu wątków.
+        * Sprawdzanie elementów i rozmiaru tego samego zbioru odbywa się
+        * równolegle, a pozostałe operacje na zbiorze wykonują się po kolei. */
+
         /* Tworzy nowy zbiór i zwraca jego identyfikator. */
         unsigned long encstrset_new();
 
@@ -36,18 +40,60 @@ extern "C" {
         * jest true, gdy element został dodany, a false w przeciwnym przypadku. */
         bool encstrset_insert(unsigned long id, const char *value, const char *key);
 
+        /* Działa jak encstrset_insert, ale element value ma value_size znaków, a
+        * klucz key ma key_size znaków, przy czym mogą one zawierać znaki zerowe.
+        * Klucz NULL jest traktowany jak pusty. */
+        bool encstrset_insert_n(unsigned long id, const char *value, size_t value_size,
+                                const char *key, size_t key_size);
+
+        /* Dla każdego z count elementów tablicy values działa jak encstrset_insert
+        * z kluczem key, przy czym zbiór jest wyszukiwany tylko raz. Jeżeli results
+        * nie jest NULL, to results[i] jest wynikiem dla elementu values[i].
+        * Wynikiem jest liczba dodanych elementów. */
+        size_t encstrset_insert_many(unsigned long id, const char *const *values, size_t count,
+                                     const char *key, bool *results);
+
+        /* Działa jak encstrset_insert_many, ale elementy values[i] mają po
+        * value_sizes[i] znaków, a klucz key ma key_size znaków, jak w
+        * encstrset_insert_n. Jeżeli value_sizes jest NULL, to elementy są
+        * zakończone znakiem zerowym. */
+        size_t encstrset_insert_many_n(unsigned long id, const char *const *values, const size_t *value_sizes,
+                                       size_t count, const char *key, size_t key_size, bool *results);
+
         /* Jeżeli istnieje zbiór o identyfikatorze id i element value zaszyfrowany
         * kluczem key należy do tego zbioru, to usuwa element ze zbioru, a w
         * przeciwnym przypadku nie robi nic. Wynikiem jest true, gdy element został
         * usunięty, a false w przeciwnym przypadku. */
         bool encstrset_remove(unsigned long id, const char *value, const char *key);
 
+        /* Działa jak encstrset_remove, ale element value ma value_size znaków, a
+        * klucz key ma key_size znaków, jak w encstrset_insert_n. */
+        bool encstrset_remove_n(unsigned long id, const char *value, size_t value_size,
+                                const char *key, size_t key_size);
+
 
         /* Jeżeli istnieje zbiór o identyfikatorze id i element value zaszyfrowany
         * kluczem key należy do tego zbioru, to zwraca true, a w przeciwnym
         * przypadku zwraca false. */
         bool encstrset_test(unsigned long id, const char *value, const char *key);
 
+        /* Działa jak encstrset_test, ale element value ma value_size znaków, a
+        * klucz key ma key_size znaków, jak w encstrset_insert_n. */
+        bool encstrset_test_n(unsigned long id, const char *value, size_t value_size,
+                              const char *key, size_t key_size);
+
+        /* Dla każdego z count elementów tablicy values działa jak encstrset_test
+        * z kluczem key, przy czym zbiór jest wyszukiwany tylko raz. Jeżeli results
+        * nie jest NULL, to results[i] jest wynikiem dla elementu values[i].
+        * Wynikiem jest liczba elementów należących do zbioru. */
+        size_t encstrset_test_many(unsigned long id, const char *const *values, size_t count,
+                                   const char *key, bool *results);
+
+        /* Działa jak encstrset_test_many, ale elementy i klucz mają podane
+        * rozmiary, jak w encstrset_insert_many_n. */
+        size_t encstrset_test_many_n(unsigned long id, const char *const *values, const size_t *value_sizes,
+                                     size_t count, const char *key, size_t key_size, bool *results);
+
 
         /* Jeżeli istnieje zbiór o identyfikatorze id, usuwa wszystkie jego elementy,
         * a w przeciwnym przypadku nie robi nic. */
@@ -59,6 +105,48 @@ extern "C" {
         * dst_id, a w przeciwnym przypadku nic nie robi. */
         void encstrset_copy(unsigned long src_id, unsigned long dst_id);
 
+        /* Jeżeli istnieją zbiory o identyfikatorach src_id oraz dst_id, to dodaje
+        * do zbioru o identyfikatorze dst_id elementy zbioru o identyfikatorze
+        * src_id, tak jak encstrset_copy, a w przeciwnym przypadku nic nie robi. */
+        void encstrset_union(unsigned long src_id, unsigned long dst_id);
+
+        /* Jeżeli istnieją zbiory o identyfikatorach src_id oraz dst_id, to usuwa
+        * ze zbioru o identyfikatorze dst_id elementy, które nie należą do zbioru
+        * o identyfikatorze src_id, a w przeciwnym przypadku nic nie robi. */
+        void encstrset_intersect(unsigned long src_id, unsigned long dst_id);
+
+        /* Jeżeli istnieją zbiory o identyfikatorach src_id oraz dst_id, to usuwa
+        * ze zbioru o identyfikatorze dst_id elementy, które należą do zbioru
+        * o identyfikatorze src_id, a w przeciwnym przypadku nic nie robi. */
+        void encstrset_difference(unsigned long src_id, unsigned long dst_id);
+
+
+        /* Jeżeli istnieje zbiór o identyfikatorze id, to zapisuje go do pliku path
+        * i zwraca true, a w przeciwnym przypadku lub w razie błędu zwraca false.
+        * Plik jest zastępowany dopiero po zapisaniu całego zbioru. */
+        bool encstrset_save(unsigned long id, const char *path);
+
+        /* Tworzy nowy zbiór z elementami zbioru zapisanego przez encstrset_save do
+        * pliku path i zwraca jego identyfikator, a w razie błędu zwraca ULONG_MAX.
+        * Plik jest odwzorowywany w pamięci i zbiór jest odczytywany bezpośrednio
+        * z niego, a jego części są kopiowane do pamięci dopiero przy zmianach. */
+        unsigned long encstrset_load(const char *path);
+
+
+        /* Jeżeli istnieje zbiór o identyfikatorze id, to włącza jego filtr, gdy
+        * enabled jest true, lub wyłącza go w przeciwnym przypadku, i zwraca true,
+        * a w przeciwnym przypadku zwraca false. Filtr pozwala sprawdzić, że
+        * element nie należy do zbioru, bez przeszukiwania zbioru. Zajmuje
+        * dodatkową pamięć i jest aktualizowany przy każdej zmianie zbioru. */
+        bool encstrset_filter(unsigned long id, bool enabled);
+
+        /* Jeżeli istnieje zbiór o identyfikatorze id z włączonym filtrem, to
+        * zapisuje szacowane prawdopodobieństwo, że filtr nie odrzuci elementu
+        * spoza zbioru, w *false_positive_rate, a rozmiar filtra w bajtach
+        * w *memory_size, o ile wskaźniki nie są NULL, i zwraca true, a
+        * w przeciwnym przypadku zwraca false. */
+        bool encstrset_filter_stats(unsigned long id, double *false_positive_rate, size_t *memory_size);
+
 #ifdef __cplusplus
     }
 }